@@ -1,34 +1,413 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <sys/time.h>
 #include <unistd.h>
 #include "jody_hash.h"
 
 #define BLOCKSIZE 32768
 
+/* Short keys for the multi-buffer benchmark (about English word length) */
+#define KEYS 4096
+#define KEYMAXLEN 16
+
+static long long usec_since(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return ((now.tv_sec - start->tv_sec) * 1000000LL) + (now.tv_usec - start->tv_usec);
+}
+
+/* Compare one jody_block_hash() call per key with the inline
+ * jody_block_hash_small() and with jody_block_hash_multi() */
+static int benchmark_multi(unsigned long long iterations)
+{
+	static unsigned char keydata[KEYS * KEYMAXLEN];
+	static const void *bufs[KEYS];
+	static size_t lens[KEYS];
+	static jodyhash_t out[KEYS];
+	struct timeval starttime;
+	long long single_usec, small_usec, multi_usec;
+	uint32_t seed = 1;
+
+	for (size_t i = 0; i < KEYS * KEYMAXLEN; i++) {
+		seed = seed * 1103515245U + 12345U;
+		keydata[i] = (unsigned char)(seed >> 16);
+	}
+	for (size_t i = 0; i < KEYS; i++) {
+		seed = seed * 1103515245U + 12345U;
+		bufs[i] = keydata + (i * KEYMAXLEN);
+		lens[i] = 1 + ((seed >> 16) % KEYMAXLEN);
+	}
+
+	gettimeofday(&starttime, NULL);
+	for (unsigned long long cnt = iterations; cnt; cnt--)
+		for (size_t i = 0; i < KEYS; i++) {
+			out[i] = 0;
+			jody_block_hash((jodyhash_t *)(uintptr_t)bufs[i], &out[i], lens[i]);
+		}
+	single_usec = usec_since(&starttime);
+
+	gettimeofday(&starttime, NULL);
+	for (unsigned long long cnt = iterations; cnt; cnt--)
+		for (size_t i = 0; i < KEYS; i++) {
+			out[i] = 0;
+			jody_block_hash_small(bufs[i], &out[i], lens[i]);
+		}
+	small_usec = usec_since(&starttime);
+
+	gettimeofday(&starttime, NULL);
+	for (unsigned long long cnt = iterations; cnt; cnt--) {
+		memset(out, 0, sizeof(out));
+		jody_block_hash_multi(bufs, lens, out, KEYS);
+	}
+	multi_usec = usec_since(&starttime);
+
+	if (single_usec < 1 || small_usec < 1 || multi_usec < 1) {
+		fprintf(stderr, "Elapsed time invalid, aborting\n");
+		return EXIT_FAILURE;
+	}
+	printf("%llu x %d keys of 1-%d bytes: %llu keys/sec one at a time, %llu keys/sec inline, %llu keys/sec multi-buffer\n",
+			iterations, KEYS, KEYMAXLEN,
+			(unsigned long long)((iterations * KEYS * 1000000) / (unsigned long long)single_usec),
+			(unsigned long long)((iterations * KEYS * 1000000) / (unsigned long long)small_usec),
+			(unsigned long long)((iterations * KEYS * 1000000) / (unsigned long long)multi_usec)
+			);
+	return EXIT_SUCCESS;
+}
+
+/* K hashes per key the old way (K seeded calls) and with one
+ * jody_block_hash_k() call, for key sizes from a word to a file block */
+#define K 7
+static int benchmark_k(unsigned long long iterations)
+{
+	static const size_t sizes[] = { 8, 64, 4096 };
+	static unsigned char keydata[KEYS + 4096];
+	jodyhash_t out[K];
+	struct timeval starttime;
+	long long seeded_usec, k_usec;
+	uint32_t seed = 1;
+
+	for (size_t i = 0; i < sizeof(keydata); i++) {
+		seed = seed * 1103515245U + 12345U;
+		keydata[i] = (unsigned char)(seed >> 16);
+	}
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		const unsigned long long keys = (iterations * KEYS * 8) / sizes[s];
+
+		gettimeofday(&starttime, NULL);
+		for (unsigned long long i = 0; i < keys; i++)
+			for (unsigned int k = 0; k < K; k++)
+				jody_block_hash_seeded(keydata + (i % KEYS), sizes[s], k, &out[k]);
+		seeded_usec = usec_since(&starttime);
+
+		gettimeofday(&starttime, NULL);
+		for (unsigned long long i = 0; i < keys; i++)
+			jody_block_hash_k(keydata + (i % KEYS), sizes[s], 0, out, K);
+		k_usec = usec_since(&starttime);
+
+		if (seeded_usec < 1 || k_usec < 1) {
+			fprintf(stderr, "Elapsed time invalid, aborting\n");
+			return EXIT_FAILURE;
+		}
+		printf("%d hashes of %llu keys of %zu bytes: %llu keys/sec with %d seeded calls, %llu keys/sec with jody_block_hash_k\n",
+				K, keys, sizes[s],
+				(unsigned long long)((keys * 1000000) / (unsigned long long)seeded_usec), K,
+				(unsigned long long)((keys * 1000000) / (unsigned long long)k_usec)
+				);
+	}
+	return EXIT_SUCCESS;
+}
+
+/* Content-defined chunking of mb MiB of random data with 8K average
+ * chunks: finding the cut points alone, then with the fingerprints
+ * (JODY_HASH_KERNEL=none shows the scalar boundary scan) */
+static int benchmark_cdc(unsigned long long mb)
+{
+	const size_t size = (size_t)mb * 1048576;
+	unsigned char *buf;
+	jody_cdc_t cdc;
+	jody_chunk_t chunks[256];
+	struct timeval starttime;
+	long long cut_usec, chunk_usec;
+	size_t n = 0, len, used;
+	uint32_t seed = 1;
+
+	buf = (unsigned char *)malloc(size);
+	if (buf == NULL || jody_cdc_init(&cdc, 0, 8192, 0) != 0) {
+		fprintf(stderr, "Out of memory\n");
+		free(buf);
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < size; i++) {
+		seed = seed * 1103515245U + 12345U;
+		buf[i] = (unsigned char)(seed >> 16);
+	}
+
+	gettimeofday(&starttime, NULL);
+	for (size_t offset = 0; offset < size; offset += len, n++)
+		len = jody_cdc_next(&cdc, buf + offset, size - offset, 1);
+	cut_usec = usec_since(&starttime);
+
+	gettimeofday(&starttime, NULL);
+	for (size_t offset = 0; offset < size; offset += used)
+		jody_cdc_chunks(&cdc, buf + offset, size - offset, 1, chunks, sizeof(chunks) / sizeof(jody_chunk_t), &used);
+	chunk_usec = usec_since(&starttime);
+
+	free(buf);
+	if (cut_usec < 1 || chunk_usec < 1) {
+		fprintf(stderr, "Elapsed time invalid, aborting\n");
+		return EXIT_FAILURE;
+	}
+	printf("%zu chunks in %llu MiB: %llu MB/sec finding cut points, %llu MB/sec with fingerprints\n",
+			n, mb,
+			(unsigned long long)size / (unsigned long long)cut_usec * 1000000 / 1048576,
+			(unsigned long long)size / (unsigned long long)chunk_usec * 1000000 / 1048576
+			);
+	return EXIT_SUCCESS;
+}
+
+/* Asynchronous hashing: 'iterations' times KEYS short keys and then 1 MiB
+ * buffers as fast as they can be submitted, with how long the jobs sat
+ * in the queue (submission to callback) and the throughput */
+#define ASYNCBIG 1048576
+struct async_job {
+	struct timeval submitted;
+	long long queued_usec;
+};
+
+static void async_done(void *ctx, const jodyhash_t hash, const int error)
+{
+	struct async_job *job = (struct async_job *)ctx;
+
+	(void)hash; (void)error;
+	job->queued_usec = usec_since(&job->submitted);
+	return;
+}
+
+static int compare_ll(const void *a, const void *b)
+{
+	const long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static int benchmark_async(unsigned long long iterations)
+{
+	static unsigned char keydata[KEYS * KEYMAXLEN];
+	const size_t counts[2] = { (size_t)iterations * KEYS, (size_t)iterations * 4 };
+	unsigned char *big;
+	struct async_job *jobs;
+	long long *queued, usec, total;
+	struct timeval starttime;
+	uint32_t seed = 1;
+
+	for (size_t i = 0; i < KEYS * KEYMAXLEN; i++) {
+		seed = seed * 1103515245U + 12345U;
+		keydata[i] = (unsigned char)(seed >> 16);
+	}
+	big = (unsigned char *)malloc(ASYNCBIG * 4);
+	jobs = (struct async_job *)malloc(counts[0] * sizeof(struct async_job));
+	queued = (long long *)malloc(counts[0] * sizeof(long long));
+	if (big == NULL || jobs == NULL || queued == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		free(big); free(jobs); free(queued);
+		return EXIT_FAILURE;
+	}
+	memset(big, 0x5a, ASYNCBIG * 4);
+
+	for (int pass = 0; pass < 2; pass++) {
+		const size_t n = counts[pass];
+		size_t len, bytes = 0;
+
+		gettimeofday(&starttime, NULL);
+		for (size_t i = 0; i < n; i++) {
+			const unsigned char *buf;
+
+			if (pass == 0) {
+				buf = keydata + (i % KEYS) * KEYMAXLEN;
+				len = 1 + (i % KEYMAXLEN);
+			} else {
+				buf = big + (i % 4) * ASYNCBIG;
+				len = ASYNCBIG;
+			}
+			bytes += len;
+			gettimeofday(&jobs[i].submitted, NULL);
+			if (jody_hash_submit(buf, len, async_done, &jobs[i]) != 0) {
+				fprintf(stderr, "jody_hash_submit failed\n");
+				jody_hash_wait();
+				free(big); free(jobs); free(queued);
+				return EXIT_FAILURE;
+			}
+		}
+		jody_hash_wait();
+		usec = usec_since(&starttime);
+		if (usec < 1) {
+			fprintf(stderr, "Elapsed time invalid, aborting\n");
+			free(big); free(jobs); free(queued);
+			return EXIT_FAILURE;
+		}
+		total = 0;
+		for (size_t i = 0; i < n; i++) {
+			queued[i] = jobs[i].queued_usec;
+			total += queued[i];
+		}
+		qsort(queued, n, sizeof(long long), compare_ll);
+		printf("%zu async %s: %llu jobs/sec, %llu MB/sec; submit to callback %lld usec average, %lld usec 99th percentile\n",
+				n, pass == 0 ? "keys of 1-16 bytes" : "1 MiB buffers",
+				(unsigned long long)(n * 1000000ULL / (unsigned long long)usec),
+				(unsigned long long)bytes / (unsigned long long)usec * 1000000 / 1048576,
+				total / (long long)n, queued[n - n / 100 - 1]);
+	}
+	free(big); free(jobs); free(queued);
+	return EXIT_SUCCESS;
+}
+
+/* Hash buffers from 64 KiB up to maxmb MiB, about 2 GiB worth for each
+ * size, to show where the large-input mode kicks in */
+static int benchmark_sweep(unsigned long long maxmb)
+{
+	const size_t maxsize = (size_t)maxmb * 1048576;
+	const size_t total = (size_t)2048 * 1048576;
+	jodyhash_t *buf;
+	jodyhash_t hash = 0;
+	struct timeval starttime;
+	long long usec;
+
+	buf = (jodyhash_t *)malloc(maxsize);
+	if (buf == NULL) {
+		fprintf(stderr, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
+	/* Touch every page so page faults aren't part of the timing */
+	memset(buf, 0x5a, maxsize);
+
+	for (size_t size = 65536; size <= maxsize; size *= 2) {
+		const size_t reps = (total / size) ? (total / size) : 1;
+
+		gettimeofday(&starttime, NULL);
+		for (size_t i = 0; i < reps; i++) jody_block_hash(buf, &hash, size);
+		usec = usec_since(&starttime);
+		if (usec < 1) usec = 1;
+		printf("%10zu KiB: %6llu MB/sec\n", size / 1024,
+				(unsigned long long)((reps * size) / (unsigned long long)usec) * 1000000 / 1048576);
+	}
+	free(buf);
+	return EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv)
 {
 	static struct timeval starttime, endtime;
 	static long long elapsed;
 	static jodyhash_t hash = 0;
 	static unsigned long long iterations, cnt;
-	static jodyhash_t block[BLOCKSIZE / sizeof(jodyhash_t)];
+	/* One spare word so the block can be shifted off of alignment */
+	static jodyhash_t block[(BLOCKSIZE / sizeof(jodyhash_t)) + 1];
+	static jodyhash_t *data;
+	static int offset = 0;
+	static int (*hashfunc)(jodyhash_t *, jodyhash_t *, const size_t) = jody_block_hash;
+	static const char *variant = "";
+#if JODY_HASH_WIDTH == 64
+	static jodyhash128_t hash128 = { 0, 0 };
+	static int use128 = 0;
+#endif
 
-	if (argc != 2) {
-		fprintf(stderr, "Specify number of iterations to run\n");
+	/* -W benchmarks the jodyhash-wide variant instead */
+	if (argc > 1 && strcmp(argv[1], "-W") == 0) {
+		hashfunc = jody_block_hash_wide;
+		variant = "jodyhash-wide: ";
+		argc--;
+		argv++;
+	}
+#if JODY_HASH_WIDTH == 64
+	/* -w 128 benchmarks jodyhash128 */
+	else if (argc > 2 && strcmp(argv[1], "-w") == 0 && strcmp(argv[2], "128") == 0) {
+		use128 = 1;
+		variant = "jodyhash128: ";
+		argc -= 2;
+		argv += 2;
+	}
+#endif
+
+	if (argc != 2 && argc != 3) {
+		fprintf(stderr, "Specify [-W | -w 128] number of iterations to run and optional byte offset\n");
+		fprintf(stderr, "or -m and number of iterations for the multi-buffer benchmark\n");
+		fprintf(stderr, "or -k and number of iterations for the k hashes per key benchmark\n");
+		fprintf(stderr, "or -c and a size in MiB for the content-defined chunking benchmark\n");
+		fprintf(stderr, "or -s and the largest size in MiB for the buffer size sweep\n");
+		fprintf(stderr, "or -a and number of iterations for the asynchronous hashing benchmark\n");
 		exit(EXIT_FAILURE);
 	}
 
-	iterations = atoi(argv[1]);
+	if (strcmp(argv[1], "-s") == 0) {
+		iterations = (argc == 3) ? strtoull(argv[2], NULL, 10) : 0;
+		if (iterations < 1) {
+			fprintf(stderr, "Size must be a positive number of MiB\n");
+			exit(EXIT_FAILURE);
+		}
+		exit(benchmark_sweep(iterations));
+	}
+
+	if (strcmp(argv[1], "-c") == 0) {
+		iterations = (argc == 3) ? strtoull(argv[2], NULL, 10) : 0;
+		if (iterations < 1) {
+			fprintf(stderr, "Size must be a positive number of MiB\n");
+			exit(EXIT_FAILURE);
+		}
+		exit(benchmark_cdc(iterations));
+	}
+
+	if (strcmp(argv[1], "-m") == 0) {
+		iterations = (argc == 3) ? strtoull(argv[2], NULL, 10) : 0;
+		if (iterations < 1) {
+			fprintf(stderr, "Iteration count must be a positive integer\n");
+			exit(EXIT_FAILURE);
+		}
+		exit(benchmark_multi(iterations));
+	}
+
+	if (strcmp(argv[1], "-k") == 0) {
+		iterations = (argc == 3) ? strtoull(argv[2], NULL, 10) : 0;
+		if (iterations < 1) {
+			fprintf(stderr, "Iteration count must be a positive integer\n");
+			exit(EXIT_FAILURE);
+		}
+		exit(benchmark_k(iterations));
+	}
+
+	if (strcmp(argv[1], "-a") == 0) {
+		iterations = (argc == 3) ? strtoull(argv[2], NULL, 10) : 0;
+		if (iterations < 1) {
+			fprintf(stderr, "Iteration count must be a positive integer\n");
+			exit(EXIT_FAILURE);
+		}
+		exit(benchmark_async(iterations));
+	}
+
+	iterations = strtoull(argv[1], NULL, 10);
 
 	if (iterations < 1) {
 		fprintf(stderr, "Iteration count must be a positive integer\n");
 		exit(EXIT_FAILURE);
 	}
 
+	/* A non-zero offset benchmarks hashing of unaligned data */
+	if (argc == 3) offset = atoi(argv[2]);
+	if (offset < 0 || offset >= (int)sizeof(jodyhash_t)) {
+		fprintf(stderr, "Offset must be between 0 and %d\n", (int)sizeof(jodyhash_t) - 1);
+		exit(EXIT_FAILURE);
+	}
+	data = (jodyhash_t *)(void *)((char *)block + offset);
+
 	gettimeofday(&starttime, NULL);
-	for (cnt = iterations; cnt; cnt--) hash = jody_block_hash((jodyhash_t *)&block, hash, BLOCKSIZE);
+#if JODY_HASH_WIDTH == 64
+	if (use128) for (cnt = iterations; cnt; cnt--) jody_block_hash128(data, &hash128, BLOCKSIZE);
+	else
+#endif
+	for (cnt = iterations; cnt; cnt--) hashfunc(data, &hash, BLOCKSIZE);
 	gettimeofday(&endtime, NULL);
 	elapsed = endtime.tv_sec - starttime.tv_sec;
 	elapsed *= 1000000;
@@ -38,9 +417,10 @@ int main(int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
-	printf("%llu blocks in %lld uSec (%llu blocks per second, %llu MB/sec overall)\n", iterations, elapsed,
-			(unsigned long long)((iterations * 1000000) / elapsed),
-			(unsigned long long)((iterations * 1000000) / elapsed) * BLOCKSIZE / 1048576
+	printf("%s%llu blocks at offset %d in %lld uSec (%llu blocks per second, %llu MB/sec overall)\n",
+			variant, iterations, offset, elapsed,
+			(unsigned long long)((iterations * 1000000) / (unsigned long long)elapsed),
+			(unsigned long long)((iterations * 1000000) / (unsigned long long)elapsed) * BLOCKSIZE / 1048576
 			);
 	exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,108 @@
+/* Hash table benchmark for jody_hash.hpp: std::hash against jodyhash
+ * with string_view lookups and with keys that carry their hash
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "jody_hash.hpp"
+
+#ifndef __cpp_lib_generic_unordered_lookup
+ #error "benchmark_hpp needs C++20 heterogeneous unordered_map lookups"
+#endif
+
+#define ROUNDS 10
+
+using clock_type = std::chrono::steady_clock;
+
+static double msec_since(const clock_type::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(clock_type::now() - start).count();
+}
+
+static void report(const char *name, const double build_ms, const double lookup_ms, const std::size_t lookups, const long found)
+{
+	printf("%-32s build %7.1f ms, %zu lookups in %7.1f ms (%5.1f ns each, %ld found)\n",
+			name, build_ms, lookups, lookup_ms, (lookup_ms * 1000000.0) / (double)lookups, found);
+	return;
+}
+
+/* Build a map of all the words, then look each of them up ROUNDS times;
+ * Key makes the map keys, Lookup turns a word into what find() gets */
+template <typename Map, typename Word, typename Key, typename Lookup>
+static void run(const char *name, const std::vector<Word> &words, const Key &key, const Lookup &lookup)
+{
+	Map map;
+	clock_type::time_point start;
+	double build_ms, lookup_ms;
+	long found = 0;
+	int n = 0;
+
+	start = clock_type::now();
+	for (const auto &word : words) map.emplace(key(word), n++);
+	build_ms = msec_since(start);
+
+	start = clock_type::now();
+	for (int round = 0; round < ROUNDS; round++)
+		for (const auto &word : words)
+			if (map.find(lookup(word)) != map.end()) found++;
+	lookup_ms = msec_since(start);
+
+	report(name, build_ms, lookup_ms, words.size() * ROUNDS, found);
+	return;
+}
+
+int main(int argc, char **argv)
+{
+	const char *path = (argc > 1) ? argv[1] : "testdata/all_english_words_lcuc.txt";
+	std::ifstream file(path, std::ios::binary);
+	std::string text;
+	std::vector<std::string_view> words;
+	std::vector<jody::hashed_string_view> hashed;
+	std::size_t start = 0, end;
+
+	if (!file) {
+		fprintf(stderr, "cannot open %s\n", path);
+		return EXIT_FAILURE;
+	}
+	text.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+	while ((end = text.find('\n', start)) != std::string::npos) {
+		if (end > start) words.emplace_back(text.data() + start, end - start);
+		start = end + 1;
+	}
+	if (words.empty()) {
+		fprintf(stderr, "no words in %s\n", path);
+		return EXIT_FAILURE;
+	}
+	printf("%zu words from %s, %d rounds of lookups\n", words.size(), path, ROUNDS);
+
+	/* The usual way: string_views have to become std::strings to look up */
+	run<std::unordered_map<std::string, int>>("std::hash, std::string lookups", words,
+			[](std::string_view w) { return std::string(w); },
+			[](std::string_view w) { return std::string(w); });
+
+	/* Transparent jodyhash: the string_view goes right in */
+	run<std::unordered_map<std::string, int, jody::string_hash, jody::string_equal>>(
+			"jodyhash, string_view lookups", words,
+			[](std::string_view w) { return std::string(w); },
+			[](std::string_view w) { return w; });
+
+	/* Keys that come with their hash, as when the same keys are looked
+	 * up over and over; the hashes are worked out before the timing */
+	hashed.reserve(words.size());
+	for (const auto &word : words) hashed.emplace_back(word);
+	run<std::unordered_map<jody::hashed_string, int, jody::string_hash, jody::string_equal>>(
+			"jodyhash, hashed_string_view", hashed,
+			[](const jody::hashed_string_view &w) { return jody::hashed_string(w); },
+			[](const jody::hashed_string_view &w) { return w; });
+	return EXIT_SUCCESS;
+}
@@ -13,112 +13,992 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef _WIN32
+ #include <sys/uio.h>
+#endif
 #include "jody_hash.h"
 #include "jody_hash_simd.h"
 #include "likely_unlikely.h"
 
+/* Calibration clock sources and cache size lookup */
+#ifndef NO_SIMD
+ #ifndef _WIN32
+  #include <unistd.h>
+ #endif
+ #if defined __x86_64__ || defined __i386__ || defined _M_X64 || defined _M_IX86
+  #ifdef _MSC_VER
+   #include <intrin.h>
+  #else
+   #include <x86intrin.h>
+  #endif
+ #elif defined _WIN32
+  #include <windows.h>
+ #else
+  #include <time.h>
+ #endif
+ #ifndef NO_THREADS
+  #include <pthread.h>
+ #endif
+#endif /* NO_SIMD */
+
 static const jodyhash_t jh_s_constant = JH_ROR2(JODY_HASH_CONSTANT);
 
-/* Hash a block of arbitrary size; must be divisible by sizeof(jodyhash_t)
+static void jh_wide_stripes(const jodyhash_t *data, jodyhash_t *lanes, size_t stripes);
+#if JODY_HASH_WIDTH == 64
+static void jh_words128(const jodyhash_t *data, jodyhash128_t *hash, const size_t length);
+#endif
+
+#ifndef NO_SIMD
+/* Runtime kernel dispatch
+ *
+ * The CPU is probed once, on the first call that is large enough to
+ * possibly use a kernel. The fastest supported kernel is stored in a
+ * function pointer along with the input size at which it starts beating
+ * the inline scalar loop (both measured on this machine at that time). Until then
+ * the pointer refers to jh_dispatch_init() and the threshold is zero, so
+ * jody_block_hash() needs no "initialized yet?" check of its own.
+ * Threads that get there at the same time wait on a pthread_once() for
+ * the first one to finish. The kernel pointer is stored last (release)
+ * and loaded with acquire, so whoever sees the real kernel also sees the
+ * rest of the setup; the thresholds are only a hint until then.
+ *
+ * Environment overrides (mostly for testing and benchmarking):
+ * JODY_HASH_KERNEL=name          force a kernel ("none" = scalar only)
+ * JODY_HASH_SIMD_THRESHOLD=bytes skip calibration and use this cutoff
+ * JODY_HASH_STREAM_THRESHOLD=bytes  large-input mode cutoff (0 = never)
+ * JODY_HASH_PREFETCH=bytes       large-input mode prefetch distance */
+
+/* Kernels need at least this much data to do anything */
+#define JH_MIN_THRESHOLD 32
+
+enum jh_cpu_feature { JH_CPU_NONE, JH_CPU_SSE2, JH_CPU_AVX2, JH_CPU_AVX512F, JH_CPU_BMI2 };
+
+struct jh_kernel {
+	const char *name;
+	jh_kernel_t func;
+	enum jh_cpu_feature feature;
+	jh_wide_kernel_t wide;
+	jh_multi_kernel_t multi;
+	jh_kernel128_t h128;
+	jh_cdc_kernel_t cdc;
+};
+
+/* Multi-buffer and jodyhash128 kernels only exist for 64-bit width */
+#if JODY_HASH_WIDTH == 64
+ #define JH_W64(f) f
+#else
+ #define JH_W64(f) NULL
+#endif
+
+/* Compiled-in kernels; on a tie in calibration the earlier one wins
+ *
+ * The SSE2/AVX2/AVX-512 entries for plain jodyhash ('func') don't beat the
+ * pipelined scalar loop on current x86 CPUs (AVX-512 is clearly slower), so
+ * calibration normally leaves them out. The multi/wide/h128/cdc kernels on
+ * the same rows are the ones that pay for building these files. */
+static const struct jh_kernel jh_kernels[] = {
+#ifndef NO_AVX512
+	{ "avx512", jody_block_hash_avx512, JH_CPU_AVX512F, NULL, JH_W64(jody_block_hash_multi_avx512), NULL, jody_cdc_scan_avx512 },
+#endif
+#ifndef NO_AVX2
+	{ "avx2", jody_block_hash_avx2, JH_CPU_AVX2, jody_block_hash_wide_avx2, JH_W64(jody_block_hash_multi_avx2), JH_W64(jody_block_hash128_avx2), NULL },
+#endif
+#ifndef NO_SSE2
+	{ "sse2", jody_block_hash_sse2, JH_CPU_SSE2, jody_block_hash_wide_sse2, NULL, NULL, NULL },
+#endif
+#ifndef NO_BMI2
+	{ "bmi2", jody_block_hash_bmi2, JH_CPU_BMI2, NULL, NULL, NULL, NULL },
+#endif
+#ifndef NO_VECEXT
+	{ "vec", jody_block_hash_vec, JH_CPU_NONE, NULL, NULL, NULL, NULL },
+#endif
+	{ NULL, NULL, JH_CPU_NONE, NULL, NULL, NULL, NULL }
+};
+
+static int jh_dispatch_init(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length);
+
+/* Used when no kernel beats the scalar loop; the threshold keeps it from being called */
+static int jh_no_kernel(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length)
+{
+	(void)data; (void)hash; (void)count; (void)length;
+	return 0;
+}
+
+static jh_kernel_t jh_simd_kernel = jh_dispatch_init;
+static size_t jh_simd_threshold = 0;
+#define JH_KERNEL() __atomic_load_n(&jh_simd_kernel, __ATOMIC_ACQUIRE)
+#define JH_DISPATCH_PENDING() unlikely(JH_KERNEL() == jh_dispatch_init)
+#define JH_THRESHOLD(t) __atomic_load_n(&(t), __ATOMIC_RELAXED)
+static const char *jh_simd_kernel_name = "none";
+static jh_multi_kernel_t jh_multi_kernel = NULL;
+static jh_cdc_kernel_t jh_cdc_scan_kernel = NULL;
+#endif /* NO_SIMD */
+static jh_wide_kernel_t jh_wide_kernel = jh_wide_stripes;
+#if JODY_HASH_WIDTH == 64
+static jh_kernel128_t jh_kernel128 = jh_words128;
+#endif
+
+
+#ifndef NO_SIMD
+static int jh_cpu_supports(const enum jh_cpu_feature feature)
+{
+#if (defined __GNUC__ || defined __clang__) && (defined __x86_64__ || defined __i386__)
+	switch (feature) {
+		case JH_CPU_NONE: return 1;
+		case JH_CPU_SSE2: return __builtin_cpu_supports("sse2");
+		case JH_CPU_AVX2: return __builtin_cpu_supports("avx2");
+		case JH_CPU_AVX512F: return __builtin_cpu_supports("avx512f");
+		case JH_CPU_BMI2: return __builtin_cpu_supports("bmi2");
+		default: return 0;
+	}
+#else
+	(void)feature;
+	return 1;
+#endif /* GCC/Clang on x86 */
+}
+
+
+/* Cheap high resolution clock for calibration */
+static inline uint64_t jh_ticks(void)
+{
+#if defined __x86_64__ || defined __i386__ || defined _M_X64 || defined _M_IX86
+	return __rdtsc();
+#elif defined _WIN32
+	LARGE_INTEGER ticks;
+
+	QueryPerformanceCounter(&ticks);
+	return (uint64_t)ticks.QuadPart;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000U + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+
+/* Keeps the calibration loops from being optimized away */
+static volatile jodyhash_t jh_calibrate_sink;
+
+/* Best-of-several TSC timing of hashing 'size' bytes with or without a kernel */
+static uint64_t jh_calibrate_time(const jh_kernel_t kernel, jodyhash_t *buf, const size_t size)
+{
+	uint64_t start, elapsed, best = UINT64_MAX;
+	jodyhash_t hash = 0;
+	jodyhash_t *data;
+	size_t length;
+
+	for (int round = 0; round < 16; round++) {
+		start = jh_ticks();
+		for (int rep = 0; rep < 32; rep++) {
+			data = buf;
+			length = size / sizeof(jodyhash_t);
+			if (kernel != NULL) kernel(&data, &hash, size, &length);
+			jh_hash_words(data, &hash, length);
+		}
+		elapsed = jh_ticks() - start;
+		if (elapsed < best) best = elapsed;
+	}
+	jh_calibrate_sink = hash;
+	return best;
+}
+
+
+/* Sizes tried during calibration; the largest also ranks the kernels */
+static const size_t jh_calibrate_sizes[] = { 32, 64, 96, 128, 192, 256, 384, 512, 768, 1024 };
+#define JH_CALIBRATE_SIZES (sizeof(jh_calibrate_sizes) / sizeof(size_t))
+#define JH_CALIBRATE_MAX 1024
+static jodyhash_t jh_calibrate_buf[JH_CALIBRATE_MAX / sizeof(jodyhash_t)];
+
+/* A kernel must be faster by 1/2^JH_CALIBRATE_MARGIN to count as faster.
+ * TSC jitter is a few percent, so anything closer than that is a coin
+ * toss that would pick a different kernel or cutoff from run to run. */
+#define JH_CALIBRATE_MARGIN 3
+#define JH_CALIBRATE_WINS(t, than) ((t) + ((t) >> JH_CALIBRATE_MARGIN) < (than))
+
+/* Find the smallest size from which the kernel is always clearly faster
+ * than the scalar loop; SIZE_MAX if the kernel never wins at all */
+static size_t jh_calibrate(const jh_kernel_t kernel)
+{
+	size_t threshold = SIZE_MAX;
+
+	for (size_t i = JH_CALIBRATE_SIZES; i > 0; i--) {
+		const size_t size = jh_calibrate_sizes[i - 1];
+		uint64_t scalar_time = jh_calibrate_time(NULL, jh_calibrate_buf, size);
+		if (!JH_CALIBRATE_WINS(jh_calibrate_time(kernel, jh_calibrate_buf, size), scalar_time)) break;
+		threshold = size;
+	}
+	return threshold;
+}
+
+
+/* Large-input mode
+ *
+ * Inputs bigger than the last level cache come from DRAM no matter what.
+ * The hardware prefetchers don't run far enough ahead to keep up with
+ * the hash, and what they fetch pushes everything else out of the cache.
+ * At jh_stream_threshold bytes and up, the kernels and the scalar loop
+ * issue a non-temporal software prefetch jh_prefetch_distance bytes
+ * ahead of the data they are hashing. The threshold starts out at zero
+ * so that the very first call comes through here and sets everything up. */
+#ifndef JH_STREAM_THRESHOLD
+#define JH_STREAM_THRESHOLD (32 * 1024 * 1024)
+#endif
+#ifndef JH_PREFETCH_DISTANCE
+#define JH_PREFETCH_DISTANCE 2048
+#endif
+
+size_t jh_stream_threshold = 0;
+size_t jh_prefetch_distance = JH_PREFETCH_DISTANCE;
+
+/* Default to the size of the last level cache if we can find it; a big
+ * L3 is shared by many cores, so no more than JH_STREAM_THRESHOLD */
+static void jh_stream_setup(void)
+{
+	const char *env_stream = getenv("JODY_HASH_STREAM_THRESHOLD");
+	const char *env_prefetch = getenv("JODY_HASH_PREFETCH");
+	size_t threshold = JH_STREAM_THRESHOLD;
+
+#if defined _SC_LEVEL3_CACHE_SIZE
+	{
+		const long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+		if (llc > 0 && (size_t)llc < threshold) threshold = (size_t)llc;
+	}
+#endif
+	if (env_stream != NULL) {
+		threshold = (size_t)strtoull(env_stream, NULL, 10);
+		if (threshold == 0) threshold = SIZE_MAX;
+	}
+	if (env_prefetch != NULL) jh_prefetch_distance = (size_t)strtoull(env_prefetch, NULL, 10);
+	if (jh_prefetch_distance == 0) threshold = SIZE_MAX;
+	__atomic_store_n(&jh_stream_threshold, threshold, __ATOMIC_RELAXED);
+	return;
+}
+
+static int jh_hash_large(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length)
+{
+	/* The first call of all sets up the thresholds, then looks again */
+	if (JH_DISPATCH_PENDING()) {
+		jody_hash_kernel(NULL);
+		if (count < jh_stream_threshold) {
+			if (count >= jh_simd_threshold) return jh_simd_kernel(data, hash, count, length);
+			return 0;
+		}
+	}
+
+	/* Kernels see the size and prefetch on their own */
+	if (count >= jh_simd_threshold) return jh_simd_kernel(data, hash, count, length);
+	jh_hash_words_prefetch(*data, hash, *length, jh_prefetch_distance);
+	*data += *length;
+	*length = 0;
+	return 0;
+}
+
+
+/* Pick a kernel and threshold
+ *
+ * The table order is only a guess: the SIMD kernels can lose to the
+ * pipelined scalar loops on some CPUs, so every supported kernel is timed
+ * on the largest calibration size and the fastest one is kept. Each one
+ * has to clearly beat the scalar loop and any kernel before it. */
+static void jh_dispatch_setup(void)
+{
+	const struct jh_kernel *k = NULL;
+	const char *env_kernel, *env_threshold;
+	uint64_t best_time, elapsed;
+	size_t threshold;
+
+#if (defined __GNUC__ || defined __clang__) && (defined __x86_64__ || defined __i386__)
+	__builtin_cpu_init();
+#endif
+
+	for (size_t i = 0; i < (sizeof(jh_calibrate_buf) / sizeof(jodyhash_t)); i++)
+		jh_calibrate_buf[i] = (jodyhash_t)(i * JODY_HASH_CONSTANT);
+
+	env_kernel = getenv("JODY_HASH_KERNEL");
+	env_threshold = getenv("JODY_HASH_SIMD_THRESHOLD");
+
+	/* Vertical multi-buffer, jodyhash-wide, jodyhash128 and chunk boundary
+	 * kernels always beat the scalar code, so the widest supported ones are
+	 * used without timing */
+	for (const struct jh_kernel *p = jh_kernels; p->name != NULL; p++) {
+		if (!jh_cpu_supports(p->feature)) continue;
+		if (env_kernel != NULL && strcmp(env_kernel, p->name) != 0) continue;
+		if (p->multi != NULL) {
+			jh_multi_kernel = p->multi;
+			break;
+		}
+	}
+	for (const struct jh_kernel *p = jh_kernels; p->name != NULL; p++) {
+		if (!jh_cpu_supports(p->feature)) continue;
+		if (env_kernel != NULL && strcmp(env_kernel, p->name) != 0) continue;
+		if (p->wide != NULL) {
+			jh_wide_kernel = p->wide;
+			break;
+		}
+	}
+#if JODY_HASH_WIDTH == 64
+	for (const struct jh_kernel *p = jh_kernels; p->name != NULL; p++) {
+		if (!jh_cpu_supports(p->feature)) continue;
+		if (env_kernel != NULL && strcmp(env_kernel, p->name) != 0) continue;
+		if (p->h128 != NULL) {
+			jh_kernel128 = p->h128;
+			break;
+		}
+	}
+#endif
+	for (const struct jh_kernel *p = jh_kernels; p->name != NULL; p++) {
+		if (!jh_cpu_supports(p->feature)) continue;
+		if (env_kernel != NULL && strcmp(env_kernel, p->name) != 0) continue;
+		if (p->cdc != NULL) {
+			jh_cdc_scan_kernel = p->cdc;
+			break;
+		}
+	}
+
+	best_time = jh_calibrate_time(NULL, jh_calibrate_buf, JH_CALIBRATE_MAX);
+	for (const struct jh_kernel *p = jh_kernels; p->name != NULL; p++) {
+		if (!jh_cpu_supports(p->feature)) continue;
+		if (env_kernel != NULL) {
+			if (strcmp(env_kernel, p->name) != 0) continue;
+			k = p;
+			break;
+		}
+		elapsed = jh_calibrate_time(p->func, jh_calibrate_buf, JH_CALIBRATE_MAX);
+		if (JH_CALIBRATE_WINS(elapsed, best_time)) {
+			best_time = elapsed;
+			k = p;
+		}
+	}
+
+	jh_stream_setup();
+
+#ifndef JODY_HASH_SUFFIX
+	/* Only the native width complains: the extra widths lack some kernels
+	 * (AVX-512 is 64-bit only) and quietly use none instead */
+	if (k == NULL && env_kernel != NULL && strcmp(env_kernel, "none") != 0)
+		fprintf(stderr, "jodyhash: JODY_HASH_KERNEL=%s is not built in or not supported by this CPU, using none\n", env_kernel);
+#endif
+
+	if (k == NULL) {
+		/* Nothing usable (or "none" was requested) */
+		__atomic_store_n(&jh_simd_threshold, SIZE_MAX, __ATOMIC_RELAXED);
+		__atomic_store_n(&jh_simd_kernel, jh_no_kernel, __ATOMIC_RELEASE);
+		return;
+	}
+
+	if (env_threshold != NULL) threshold = (size_t)strtoull(env_threshold, NULL, 10);
+	else threshold = jh_calibrate(k->func);
+	if (threshold < JH_MIN_THRESHOLD) threshold = JH_MIN_THRESHOLD;
+
+	jh_simd_kernel_name = k->name;
+	__atomic_store_n(&jh_simd_threshold, threshold, __ATOMIC_RELAXED);
+	__atomic_store_n(&jh_simd_kernel, k->func, __ATOMIC_RELEASE);
+	return;
+}
+
+
+/* Set up dispatch exactly once, then finish the call that triggered it */
+#ifndef NO_THREADS
+static pthread_once_t jh_dispatch_once = PTHREAD_ONCE_INIT;
+#endif
+
+static int jh_dispatch_init(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length)
+{
+#ifndef NO_THREADS
+	pthread_once(&jh_dispatch_once, jh_dispatch_setup);
+#else
+	if (jh_simd_kernel == jh_dispatch_init) jh_dispatch_setup();
+#endif
+	if (count >= jh_simd_threshold) return jh_simd_kernel(data, hash, count, length);
+	return 0;
+}
+#endif /* NO_SIMD */
+
+
+/* Report the kernel chosen for this CPU and the size where it kicks in */
+extern const char *jody_hash_kernel(size_t *threshold)
+{
+#ifndef NO_SIMD
+	jodyhash_t dummy[JH_MIN_THRESHOLD / sizeof(jodyhash_t)] = { 0 };
+	jodyhash_t *data = dummy;
+	jodyhash_t hash = 0;
+	size_t length;
+
+	/* Force dispatch to happen if it hasn't yet */
+	if (JH_DISPATCH_PENDING()) jh_dispatch_init(&data, &hash, 0, &length);
+	if (threshold != NULL) *threshold = jh_simd_threshold;
+	return jh_simd_kernel_name;
+#else
+	if (threshold != NULL) *threshold = SIZE_MAX;
+	return "none";
+#endif /* NO_SIMD */
+}
+
+
+/* For jody_hash_cdc.c, which isn't built for each width */
+extern jh_cdc_kernel_t jh_cdc_kernel(void)
+{
+#ifndef NO_SIMD
+	if (JH_DISPATCH_PENDING()) jody_hash_kernel(NULL);
+	return jh_cdc_scan_kernel;
+#else
+	return NULL;
+#endif /* NO_SIMD */
+}
+
+
+/* The last step for a partial word: 'element' holds the 1 to
+ * sizeof(jodyhash_t) - 1 bytes left over with the rest zeroed out */
+static inline void jh_hash_tail(jodyhash_t element, jodyhash_t *hash)
+{
+	jodyhash_t element2;
+
+	element2 = JH_ROR(element);
+	element2 ^= jh_s_constant;
+	element += JODY_HASH_CONSTANT;
+	*hash += element;
+	*hash ^= element2;
+	*hash = JH_ROL2(*hash);
+	*hash += element2;
+	return;
+}
+
+
+/* The partial word at the end of a count byte block; data points at it */
+static inline jodyhash_t jh_block_tail(const jodyhash_t *data, const size_t count)
+{
+	const size_t rem = count & (sizeof(jodyhash_t) - 1);
+
+#ifdef JH_TAIL_IN_BOUNDS
+	return jh_tail_load((const unsigned char *)data, rem, count > sizeof(jodyhash_t));
+#else
+	return *data & tail_mask[rem];
+#endif /* JH_TAIL_IN_BOUNDS */
+}
+
+
+/* Hash a block of arbitrary size
  * The first block should pass an initial hash of zero.
  * All blocks after the first should pass hash as the value
  * returned by the last call to this function. This allows hashing
- * of any amount of data. If data is not divisible by the size of
- * jodyhash_t, it is MANDATORY that the caller provide a data buffer
- * which is divisible by sizeof(jodyhash_t). */
+ * of any amount of data. Nothing past the end of the block is read on
+ * little-endian CPUs, so a block can end anywhere (at the end of a
+ * mapped file, say). On big-endian CPUs the last partial word is read
+ * whole: if count is not divisible by the size of jodyhash_t, it is
+ * MANDATORY there that the caller provide a data buffer which is
+ * divisible by sizeof(jodyhash_t). */
 extern int jody_block_hash(jodyhash_t *data, jodyhash_t *hash, const size_t count)
 {
-	jodyhash_t element, element2;
-	size_t length = 0;
+	size_t length;
 
 	/* Don't bother trying to hash a zero-length block */
 	if (unlikely(count == 0)) return 0;
 
-#ifndef NO_AVX2
-#if defined __GNUC__ || defined __clang__
-	__builtin_cpu_init ();
-	if (__builtin_cpu_supports ("avx2")) {
-#endif /* __GNUC__ || __clang__ */
-		if (count >= 32) {
-			if (jody_block_hash_avx2(&data, hash, count, &length) != 0) return 1;
-			goto skip_sse2;
-		} else length = count / sizeof(jodyhash_t);
-#if defined __GNUC__ || defined __clang__
-	} else length = count / sizeof(jodyhash_t);
+	length = count / sizeof(jodyhash_t);
+
+#ifndef NO_SIMD
+	/* Large blocks go to the SIMD kernel which leaves the last few words */
+	if (unlikely(count >= JH_THRESHOLD(jh_stream_threshold))) {
+		if (jh_hash_large(&data, hash, count, &length) != 0) return 1;
+	} else if (count >= JH_THRESHOLD(jh_simd_threshold)) {
+		if (JH_KERNEL()(&data, hash, count, &length) != 0) return 1;
+	}
+#endif /* NO_SIMD */
+
+	/* Hash everything (normal) or remaining small tails (SIMD) */
+	jh_hash_words(data, hash, length);
+	data += length;
+
+	/* Handle data tail (for blocks indivisible by sizeof(jodyhash_t)) */
+	if (count & (sizeof(jodyhash_t) - 1)) jh_hash_tail(jh_block_tail(data, count), hash);
+
+	return 0;
+}
+
+
+/* This width's jody_block_hash64/32/16() (see jody_hash.h) */
+#if JODY_HASH_WIDTH == 64
+extern int jody_block_hash64(jodyhash_t *data, jodyhash_t *hash, const size_t count)
+#elif JODY_HASH_WIDTH == 32
+extern int jody_block_hash32(jodyhash_t *data, jodyhash_t *hash, const size_t count)
+#else
+extern int jody_block_hash16(jodyhash_t *data, jodyhash_t *hash, const size_t count)
 #endif
+{
+	return jody_block_hash(data, hash, count);
+}
+
+
+/* Start hashing a stream of data (see jody_hash.h) */
+extern int jody_hash_init(jodyhash_state *state)
+{
+	state->hash = 0;
+	state->partial = 0;
+	state->partial_len = 0;
+	return 0;
+}
+
+
+/* Hash the next piece of a stream; pieces can be any size */
+extern int jody_hash_update(jodyhash_state *state, const void *data, const size_t count)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	size_t left = count, whole, n;
+
+	/* Finish the partial word left over from the last piece first */
+	if (state->partial_len > 0) {
+		n = sizeof(jodyhash_t) - state->partial_len;
+		if (n > left) n = left;
+		memcpy((unsigned char *)&state->partial + state->partial_len, p, n);
+		state->partial_len += n;
+		p += n;
+		left -= n;
+		if (state->partial_len < sizeof(jodyhash_t)) return 0;
+		if (jody_block_hash(&state->partial, &state->hash, sizeof(jodyhash_t)) != 0) return 1;
+		state->partial = 0;
+		state->partial_len = 0;
+	}
+
+	whole = left & ~(sizeof(jodyhash_t) - 1);
+	if (whole > 0) {
+		if (jody_block_hash((jodyhash_t *)(uintptr_t)p, &state->hash, whole) != 0) return 1;
+		p += whole;
+		left -= whole;
+	}
+
+	if (left > 0) {
+		memcpy(&state->partial, p, left);
+		state->partial_len = left;
+	}
+	return 0;
+}
+
+
+/* Store the hash of everything so far in *hash; the state is left as it
+ * is, so more data can still be added after this */
+extern int jody_hash_final(const jodyhash_state *state, jodyhash_t *hash)
+{
+	jodyhash_t partial = state->partial;
+
+	*hash = state->hash;
+	if (state->partial_len > 0) return jody_block_hash(&partial, hash, state->partial_len);
+	return 0;
+}
+
+
+#ifndef _WIN32
+/* Hash several buffers as one block, the same as jody_block_hash() on
+ * all of them put together; *hash works the same way as there, too.
+ * Words that straddle two buffers are put together in the streaming
+ * state and the rest of each buffer is hashed in place. */
+extern int jody_block_hash_iov(const struct iovec *iov, int iovcnt, jodyhash_t *hash)
+{
+	jodyhash_state state;
+
+	if (iovcnt < 0) return 1;
+	jody_hash_init(&state);
+	state.hash = *hash;
+	for (int i = 0; i < iovcnt; i++)
+		if (jody_hash_update(&state, iov[i].iov_base, iov[i].iov_len) != 0) return 1;
+	return jody_hash_final(&state, hash);
+}
+#endif /* _WIN32 */
+
+
+/* Seeded hashing and k hashes per key (see jody_hash.h)
+ *
+ * A seed that just becomes the initial hash goes through a few adds and
+ * rotates for short keys, so nearby seeds would give nearby hashes. The
+ * seed and the result are both run through MurmurHash3's 64-bit finalizer
+ * instead, which spreads every bit over the whole hash. */
+static inline uint64_t jh_mix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return x;
+}
+
+/* Two hashes of the data from one pass: both jodyhash128 chains with
+ * 64-bit width, or the two halves of the 64-bit jodyhash otherwise
+ * (which jody_block_hash64() provides in every build). h2 is skipped
+ * when it is NULL; h1 is the same either way. */
+static int jh_hash_pair(const void *data, const size_t count, const uint64_t seed, jodyhash_t *h1, jodyhash_t *h2)
+{
+#if JODY_HASH_WIDTH == 64
+	jodyhash128_t hash128;
+
+	hash128.lo = jh_mix64(seed);
+	if (h2 == NULL) {
+		if (jody_block_hash((jodyhash_t *)(uintptr_t)data, &hash128.lo, count) != 0) return 1;
+		*h1 = jh_mix64(hash128.lo);
+		return 0;
+	}
+	hash128.hi = jh_mix64(seed ^ JODY_HASH128_CONSTANT);
+	if (jody_block_hash128((jodyhash_t *)(uintptr_t)data, &hash128, count) != 0) return 1;
+	*h1 = jh_mix64(hash128.lo);
+	*h2 = jh_mix64(hash128.hi);
 #else
-	length = count / sizeof(jodyhash_t);
-#endif /* NO_AVX2 */
+	uint64_t hash = jh_mix64(seed);
 
+	if (jody_block_hash64((uint64_t *)(uintptr_t)data, &hash, count) != 0) return 1;
+	hash = jh_mix64(hash);
+	*h1 = (jodyhash_t)hash;
+	if (h2 != NULL) *h2 = (jodyhash_t)(hash >> 32);
+#endif /* JODY_HASH_WIDTH == 64 */
+	return 0;
+}
 
-#ifndef NO_SSE2
-#if defined __GNUC__ || defined __clang__
-	__builtin_cpu_init ();
-	if (__builtin_cpu_supports ("sse2")) {
-#endif /* __GNUC__ || __clang__ */
-		if (count >= 32) {
-			if (jody_block_hash_sse2(&data, hash, count, &length) != 0) return 1;
+/* Hash a block with a seed; different seeds give unrelated hashes */
+extern int jody_block_hash_seeded(const void *data, const size_t count, const uint64_t seed, jodyhash_t *hash)
+{
+	return jh_hash_pair(data, count, seed, hash, NULL);
+}
+
+/* k hashes of a block for Bloom filters and sketches, all from one pass:
+ * enhanced double hashing (Dillinger and Manolios) on the two hashes
+ * jh_hash_pair() gives. out[0] is jody_block_hash_seeded()'s hash. */
+extern int jody_block_hash_k(const void *data, const size_t count, const uint64_t seed, jodyhash_t *out, const unsigned int k)
+{
+	jodyhash_t h1, h2;
+
+	if (k == 0) return 0;
+	if (k == 1) return jh_hash_pair(data, count, seed, out, NULL);
+	if (jh_hash_pair(data, count, seed, &h1, &h2) != 0) return 1;
+	for (unsigned int i = 0; i < k; i++) {
+		out[i] = h1;
+		h1 = (jodyhash_t)(h1 + h2);
+		h2 = (jodyhash_t)(h2 + i);
+	}
+	return 0;
+}
+
+
+/* Scalar jodyhash-wide lanes: the normal hash step, once per lane */
+static void jh_wide_stripes(const jodyhash_t *data, jodyhash_t *lanes, size_t stripes)
+{
+	jodyhash_t element, element2, lane;
+
+	for (; stripes > 0; stripes--) {
+		for (size_t l = 0; l < JODY_HASH_WIDE_LANES; l++) {
+			element = data[l];
+			element2 = JH_ROR(element);
+			element2 ^= jh_s_constant;
+			element += JODY_HASH_CONSTANT;
+			lane = lanes[l] + element;
+			lane ^= element2;
+			lane = JH_ROL2(lane);
+			lanes[l] = lane + element;
 		}
-		else length = count / sizeof(jodyhash_t);
-#if defined __GNUC__ || defined __clang__
-	} else length = count / sizeof(jodyhash_t);
-#endif
+		data += JODY_HASH_WIDE_LANES;
+	}
+	return;
+}
+
+
+/* Hash a block with the jodyhash-wide variant (see jody_hash.h)
+ * Lane l starts out as hash + l * JODY_HASH_CONSTANT and the lanes are
+ * folded into the hash in order, as if they were data words. The tail is
+ * handled the same as in jody_block_hash(), but since the lanes are folded
+ * every time, calling this again with the result is NOT the same as one
+ * call over both blocks; see jody_hash_wide_update() for that. */
+extern int jody_block_hash_wide(jodyhash_t *data, jodyhash_t *hash, const size_t count)
+{
+	jodyhash_t lanes[JODY_HASH_WIDE_LANES];
+	const size_t stripes = count / JODY_HASH_WIDE_STRIPE;
+
+	if (stripes > 0) {
+#ifndef NO_SIMD
+		if (JH_DISPATCH_PENDING()) jody_hash_kernel(NULL);
+#endif /* NO_SIMD */
+		for (size_t l = 0; l < JODY_HASH_WIDE_LANES; l++)
+			lanes[l] = (jodyhash_t)(*hash + (jodyhash_t)l * JODY_HASH_CONSTANT);
+		jh_wide_kernel(data, lanes, stripes);
+		jh_hash_words(lanes, hash, JODY_HASH_WIDE_LANES);
+		data += stripes * JODY_HASH_WIDE_LANES;
+	}
+
+	return jody_block_hash(data, hash, count - (stripes * JODY_HASH_WIDE_STRIPE));
+}
+
+
+/* Streaming jodyhash-wide: the same as jody_block_hash_wide() over all of
+ * the pieces put together. Set state->hash after init to start from a
+ * hash other than zero. */
+extern int jody_hash_wide_init(jodyhash_wide_state *state)
+{
+	memset(state, 0, sizeof(jodyhash_wide_state));
+	return 0;
+}
+
+
+/* Run whole stripes through the lanes, setting them up on the first one */
+static void jh_wide_state_stripes(jodyhash_wide_state *state, const jodyhash_t *data, const size_t stripes)
+{
+	if (state->stripes == 0) {
+#ifndef NO_SIMD
+		if (JH_DISPATCH_PENDING()) jody_hash_kernel(NULL);
+#endif /* NO_SIMD */
+		for (size_t l = 0; l < JODY_HASH_WIDE_LANES; l++)
+			state->lanes[l] = (jodyhash_t)(state->hash + (jodyhash_t)l * JODY_HASH_CONSTANT);
+	}
+	jh_wide_kernel(data, state->lanes, stripes);
+	state->stripes += stripes;
+	return;
+}
+
+
+/* Hash the next piece of a jodyhash-wide stream; pieces can be any size */
+extern int jody_hash_wide_update(jodyhash_wide_state *state, const void *data, const size_t count)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	size_t left = count, stripes, n;
+
+	/* Finish the stripe left over from the last piece first */
+	if (state->partial_len > 0) {
+		n = JODY_HASH_WIDE_STRIPE - state->partial_len;
+		if (n > left) n = left;
+		memcpy((unsigned char *)state->partial + state->partial_len, p, n);
+		state->partial_len += n;
+		p += n;
+		left -= n;
+		if (state->partial_len < JODY_HASH_WIDE_STRIPE) return 0;
+		jh_wide_state_stripes(state, state->partial, 1);
+		state->partial_len = 0;
+	}
+
+	stripes = left / JODY_HASH_WIDE_STRIPE;
+	if (stripes > 0) {
+		jh_wide_state_stripes(state, (const jodyhash_t *)(uintptr_t)p, stripes);
+		p += stripes * JODY_HASH_WIDE_STRIPE;
+		left -= stripes * JODY_HASH_WIDE_STRIPE;
+	}
+
+	if (left > 0) {
+		memcpy(state->partial, p, left);
+		state->partial_len = left;
+	}
+	return 0;
+}
+
+
+/* Store the jodyhash-wide hash of everything so far in *hash; the state
+ * is left as it is, so more data can still be added after this */
+extern int jody_hash_wide_final(const jodyhash_wide_state *state, jodyhash_t *hash)
+{
+	jodyhash_t partial[JODY_HASH_WIDE_LANES];
+
+	*hash = state->hash;
+	if (state->stripes > 0) jh_hash_words(state->lanes, hash, JODY_HASH_WIDE_LANES);
+	if (state->partial_len == 0) return 0;
+	memcpy(partial, state->partial, sizeof(partial));
+	return jody_block_hash(partial, hash, state->partial_len);
+}
+
+
+#if JODY_HASH_WIDTH == 64
+/* Scalar jodyhash128 words */
+static void jh_words128(const jodyhash_t *data, jodyhash128_t *hash, const size_t length)
+{
+#ifndef NO_SIMD
+	jh_hash_words128_prefetch(data, hash, length, JH_PREFETCH_FOR(length * sizeof(jodyhash_t)));
 #else
+	jh_hash_words128_prefetch(data, hash, length, 0);
+#endif /* NO_SIMD */
+	return;
+}
+
+
+/* Hash a block with jodyhash128 (see jody_hash.h)
+ * Chaining blocks and tail handling work the same as jody_block_hash()
+ * and hash->lo always ends up the same as it would with that. The first
+ * block should pass an initial hash of zero in both halves. */
+extern int jody_block_hash128(jodyhash_t *data, jodyhash128_t *hash, const size_t count)
+{
+	jodyhash_t element, element2;
+	size_t length;
+
+	if (unlikely(count == 0)) return 0;
+
 	length = count / sizeof(jodyhash_t);
-#endif /* NO_SSE2 */
+	if (length > 0) {
+#ifndef NO_SIMD
+		if (JH_DISPATCH_PENDING()) jody_hash_kernel(NULL);
+#endif /* NO_SIMD */
+		jh_kernel128(data, hash, length);
+		data += length;
+	}
 
-#ifndef NO_AVX2
-skip_sse2:
+	/* Data tail: the same as jody_block_hash() for each chain */
+	if (count & (sizeof(jodyhash_t) - 1)) {
+		element = jh_block_tail(data, count);
+		element2 = JH_ROR(element) ^ jh_s_constant;
+		hash->lo += element + JODY_HASH_CONSTANT;
+		hash->lo ^= element2;
+		hash->lo = JH_ROL2(hash->lo);
+		hash->lo += element2;
+		element2 = JH128_ROR(element) ^ (jodyhash_t)JODY_HASH128_CONSTANT_ROR2;
+		hash->hi += element + JODY_HASH128_CONSTANT;
+		hash->hi ^= element2;
+		hash->hi = JH128_ROL2(hash->hi);
+		hash->hi += element2;
+	}
+
+	return 0;
+}
+#endif /* JODY_HASH_WIDTH == 64 */
+
+
+/* NUL-terminated strings
+ *
+ * The string is hashed in groups of four words with the pipelined loop,
+ * and each group is checked for the NUL (along with the bytes right after
+ * it) before it is hashed, so the check mostly runs in the shadow of the
+ * hash chain and the string is only gone over once. Checks read
+ * JH_STR_CHECK bytes at a time, which can go past the NUL, but never into
+ * a page the string doesn't reach: when the check would cross a page
+ * boundary, the bytes up to the boundary are checked one at a time first.
+ * 4 KiB is the smallest page size in use anywhere, so it is safe to
+ * assume. Thanks to the look-ahead, the last few bytes before the NUL are
+ * always left for the end, where a line ending can still be dropped. */
+#define JH_STR_GROUP (4 * sizeof(jodyhash_t))
+#define JH_STR_CHECK 48
+#define JH_STR_PAGE 4096
+
+#if defined __SSE2__ && !defined NO_SSE2
+ #include <emmintrin.h>
+ #define JH_STR_SSE2
 #endif
-	/* Hash everything (normal) or remaining small tails (SSE2) */
-	for (; length > 0; length--) {
-		element = *data;
-		element2 = JH_ROR(element);
-		element2 ^= jh_s_constant;
-		element += JODY_HASH_CONSTANT;
-		*hash += element;
-		*hash ^= element2;
-		*hash = JH_ROL2(*hash);
-		*hash += element;
-		data++;
+
+/* Find a NUL in the JH_STR_CHECK bytes at p; the offset goes in *off */
+static inline int jh_str_check(const char *p, size_t *off)
+{
+#ifdef JH_STR_SSE2
+	const __m128i zero = _mm_setzero_si128();
+	uint64_t mask;
+
+	mask = (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(const void *)p), zero));
+	mask |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(const void *)(p + 16)), zero)) << 16;
+	mask |= (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(const void *)(p + 32)), zero)) << 32;
+	if (likely(mask == 0)) return 0;
+	*off = (size_t)__builtin_ctzll(mask);
+	return 1;
+#else
+	/* The classic "has a zero byte" test, a word at a time */
+	const uint64_t ones = 0x0101010101010101ULL, highs = 0x8080808080808080ULL;
+	uint64_t w, z = 0;
+
+	for (size_t i = 0; i < JH_STR_CHECK; i += sizeof(w)) {
+		memcpy(&w, p + i, sizeof(w));
+		z |= (w - ones) & ~w;
 	}
+	if (likely((z & highs) == 0)) return 0;
+	for (*off = 0; p[*off] != '\0'; (*off)++);
+	return 1;
+#endif /* JH_STR_SSE2 */
+}
 
-	/* Handle data tail (for blocks indivisible by sizeof(jodyhash_t)) */
-	length = count & (sizeof(jodyhash_t) - 1);
-	if (length) {
-		element = *data & tail_mask[length];
-		element2 = JH_ROR(element);
-		element2 ^= jh_s_constant;
-		element += JODY_HASH_CONSTANT;
-		*hash += element;
-		*hash ^= element2;
-		*hash = JH_ROL2(*hash);
-		*hash += element2;
+static int jh_str_hash(const char *s, jodyhash_t *hash, size_t *len_out, const int chomp)
+{
+	const char *p = s;
+	jodyhash_t words[JH_STR_CHECK / sizeof(jodyhash_t)];
+	size_t room, off, len, rem;
+
+	for (;;) {
+		room = JH_STR_PAGE - ((uintptr_t)p & (JH_STR_PAGE - 1));
+		if (unlikely(room < JH_STR_CHECK)) {
+			for (off = 0; off < room; off++) {
+				if (p[off] == '\0') {
+					/* Not safe to read past the NUL here */
+					memset(words, 0, sizeof(words));
+					memcpy(words, p, off);
+					goto found;
+				}
+			}
+		}
+		if (jh_str_check(p, &off)) {
+			memcpy(words, p, JH_STR_CHECK);
+			break;
+		}
+		memcpy(words, p, JH_STR_GROUP);
+		jh_hash_words(words, hash, 4);
+		p += JH_STR_GROUP;
 	}
 
+found:
+	len = (size_t)(p - s) + off;
+	if (chomp && off > 0 && p[off - 1] == '\n') {
+		len--;
+		off--;
+		if (off > 0 && p[off - 1] == '\r') {
+			len--;
+			off--;
+		}
+	}
+
+	/* The rest are less than JH_STR_CHECK bytes, all in words[] */
+	rem = off & (sizeof(jodyhash_t) - 1);
+	off /= sizeof(jodyhash_t);
+	jh_hash_words(words, hash, off);
+	if (rem > 0) jh_hash_tail(words[off] & tail_mask[rem], hash);
+
+	if (len_out != NULL) *len_out = len;
 	return 0;
 }
 
 
-#define ROLLBSIZE 4096
-#define ROLLBSIZEW (ROLLBSIZE / sizeof(jodyhash_t))
+/* Hash a C string; the same as jody_block_hash(s, hash, strlen(s)) but
+ * without going over the string twice. The length is stored in *len_out
+ * unless it is NULL. */
+extern int jody_str_hash(const char *s, jodyhash_t *hash, size_t *len_out)
+{
+	return jh_str_hash(s, hash, len_out, 0);
+}
+
+
+/* Hash a line of text (as read by fgets()) without its "\n" or "\r\n"
+ * line ending; *len_out is the length without the line ending */
+extern int jody_line_hash(const char *s, jodyhash_t *hash, size_t *len_out)
+{
+	return jh_str_hash(s, hash, len_out, 1);
+}
+
+
+/* Hash many independent keys in one call
+ * out[i] is updated exactly like jody_block_hash(bufs[i], &out[i], lens[i])
+ * would do it, so it must hold the initial hash (zero) or the result of
+ * hashing the previous block of that key. Keys are hashed several at a
+ * time in vector lanes when the CPU can do it. */
+extern int jody_block_hash_multi(const void * const *bufs, const size_t *lens, jodyhash_t *out, const size_t n)
+{
+	size_t done = 0;
+
+#ifndef NO_SIMD
+	if (JH_DISPATCH_PENDING()) jody_hash_kernel(NULL);
+	if (jh_multi_kernel != NULL) done = jh_multi_kernel(bufs, lens, out, n);
+#endif /* NO_SIMD */
+
+	for (; done < n; done++)
+		if (jody_block_hash((jodyhash_t *)(uintptr_t)bufs[done], &out[done], lens[done]) != 0) return 1;
+
+	return 0;
+}
+
+
+/* jody_rolling_hash() with JODY_ROLLING_BLOCKSIZE blocks on this thread */
 extern int jody_rolling_block_hash(jodyhash_t *data, jodyhash_t *hash, const size_t count)
 {
+	const unsigned char *p = (const unsigned char *)data;
 	jodyhash_t rollhash;
-	size_t blocks = (count & ~((uint64_t)ROLLBSIZE - 1)) / ROLLBSIZE;
-	for (unsigned int i = 0; i < blocks; i++) {
-fprintf(stderr, "rolling([%u] %p, %016" PRIx64 ", %d)\n", i, (void *)data, *hash, ROLLBSIZE);
-		rollhash = 0;
-		if (jody_block_hash(data, &rollhash, ROLLBSIZE)) return 1;
-		*hash ^= rollhash;
-		data += ROLLBSIZEW;
-	}
-	/* Hash the last block */
-	blocks = count - (blocks * ROLLBSIZE);
-	if (blocks > 0) {
-fprintf(stderr, "rolltail(%p, %016" PRIx64 ", %d)\n", (void *)data, *hash, ROLLBSIZE);
+	size_t len;
+
+	for (size_t off = 0; off < count; off += len) {
+		len = (count - off < JODY_ROLLING_BLOCKSIZE) ? count - off : JODY_ROLLING_BLOCKSIZE;
 		rollhash = 0;
-		if (jody_block_hash(data, &rollhash, blocks)) return 1;
+		if (jody_block_hash((jodyhash_t *)(uintptr_t)(p + off), &rollhash, len)) return 1;
 		*hash ^= rollhash;
 	}
 	return 0;
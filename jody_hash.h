@@ -8,8 +8,11 @@
 extern "C" {
 #endif
 
-/* Required for uint64_t */
+/* Required for uint64_t and size_t */
+#include <stddef.h>
 #include <stdint.h>
+/* memcpy() for the inline small-key code */
+#include <string.h>
 
 /* Width of a jody_hash. Changing this will also require
  * changing the width of tail masks to match. */
@@ -17,9 +20,81 @@ extern "C" {
 #define JODY_HASH_WIDTH 64
 #endif
 
-/* Version increments when algorithm changes incompatibly */
+/* All three widths are built into the library: the code is compiled once
+ * for JODY_HASH_WIDTH and once more for each of the other two widths with
+ * JODY_HASH_SUFFIX set to that width. The extra copies get their external
+ * names suffixed here so they can all be linked together; programs get at
+ * them through the jody_block_hash64/32/16() functions declared below. */
+#ifdef JODY_HASH_SUFFIX
+#define JH_SUFFIX_NAME2(name, w) name ## _w ## w
+#define JH_SUFFIX_NAME(name, w) JH_SUFFIX_NAME2(name, w)
+#define jody_block_hash JH_SUFFIX_NAME(jody_block_hash, JODY_HASH_SUFFIX)
+#define jody_block_hash128 JH_SUFFIX_NAME(jody_block_hash128, JODY_HASH_SUFFIX)
+#define jody_block_hash_iov JH_SUFFIX_NAME(jody_block_hash_iov, JODY_HASH_SUFFIX)
+#define jody_block_hash_multi JH_SUFFIX_NAME(jody_block_hash_multi, JODY_HASH_SUFFIX)
+#define jody_block_hash_wide JH_SUFFIX_NAME(jody_block_hash_wide, JODY_HASH_SUFFIX)
+#define jody_hash_wide_init JH_SUFFIX_NAME(jody_hash_wide_init, JODY_HASH_SUFFIX)
+#define jody_hash_wide_update JH_SUFFIX_NAME(jody_hash_wide_update, JODY_HASH_SUFFIX)
+#define jody_hash_wide_final JH_SUFFIX_NAME(jody_hash_wide_final, JODY_HASH_SUFFIX)
+#define jody_hash_init JH_SUFFIX_NAME(jody_hash_init, JODY_HASH_SUFFIX)
+#define jody_hash_update JH_SUFFIX_NAME(jody_hash_update, JODY_HASH_SUFFIX)
+#define jody_hash_final JH_SUFFIX_NAME(jody_hash_final, JODY_HASH_SUFFIX)
+#define jody_hash_kernel JH_SUFFIX_NAME(jody_hash_kernel, JODY_HASH_SUFFIX)
+#define jody_str_hash JH_SUFFIX_NAME(jody_str_hash, JODY_HASH_SUFFIX)
+#define jody_line_hash JH_SUFFIX_NAME(jody_line_hash, JODY_HASH_SUFFIX)
+#define jody_rolling_block_hash JH_SUFFIX_NAME(jody_rolling_block_hash, JODY_HASH_SUFFIX)
+#define jody_block_hash_seeded JH_SUFFIX_NAME(jody_block_hash_seeded, JODY_HASH_SUFFIX)
+#define jody_block_hash_k JH_SUFFIX_NAME(jody_block_hash_k, JODY_HASH_SUFFIX)
+/* Kernels and other internals (see jody_hash_simd.h) */
+#define jody_block_hash_avx512 JH_SUFFIX_NAME(jody_block_hash_avx512, JODY_HASH_SUFFIX)
+#define jody_block_hash_avx2 JH_SUFFIX_NAME(jody_block_hash_avx2, JODY_HASH_SUFFIX)
+#define jody_block_hash_sse2 JH_SUFFIX_NAME(jody_block_hash_sse2, JODY_HASH_SUFFIX)
+#define jody_block_hash_bmi2 JH_SUFFIX_NAME(jody_block_hash_bmi2, JODY_HASH_SUFFIX)
+#define jody_block_hash_vec JH_SUFFIX_NAME(jody_block_hash_vec, JODY_HASH_SUFFIX)
+#define jody_block_hash_wide_avx2 JH_SUFFIX_NAME(jody_block_hash_wide_avx2, JODY_HASH_SUFFIX)
+#define jody_block_hash_wide_sse2 JH_SUFFIX_NAME(jody_block_hash_wide_sse2, JODY_HASH_SUFFIX)
+#define jody_block_hash_multi_avx512 JH_SUFFIX_NAME(jody_block_hash_multi_avx512, JODY_HASH_SUFFIX)
+#define jody_block_hash_multi_avx2 JH_SUFFIX_NAME(jody_block_hash_multi_avx2, JODY_HASH_SUFFIX)
+#define jody_block_hash128_avx2 JH_SUFFIX_NAME(jody_block_hash128_avx2, JODY_HASH_SUFFIX)
+#define jody_cdc_scan_avx512 JH_SUFFIX_NAME(jody_cdc_scan_avx512, JODY_HASH_SUFFIX)
+#define jh_cdc_kernel JH_SUFFIX_NAME(jh_cdc_kernel, JODY_HASH_SUFFIX)
+#define jh_stream_threshold JH_SUFFIX_NAME(jh_stream_threshold, JODY_HASH_SUFFIX)
+#define jh_prefetch_distance JH_SUFFIX_NAME(jh_prefetch_distance, JODY_HASH_SUFFIX)
+#define vec_constant JH_SUFFIX_NAME(vec_constant, JODY_HASH_SUFFIX)
+#define vec_constant_ror2 JH_SUFFIX_NAME(vec_constant_ror2, JODY_HASH_SUFFIX)
+#endif /* JODY_HASH_SUFFIX */
+
+/* Version increments when algorithm changes incompatibly; it is also
+ * the major version (SONAME) of the shared library */
 #define JODY_HASH_VERSION 7
 
+/* What the shared library exports: the library is built with
+ * -fvisibility=hidden, so kernels and other internals stay inside it.
+ * The copies for the other widths only export jody_block_hash64/32/16(). */
+#if defined __GNUC__ && !defined _WIN32
+ #define JODY_HASH_EXPORT __attribute__((visibility("default")))
+#else
+ #define JODY_HASH_EXPORT
+#endif
+#ifdef JODY_HASH_SUFFIX
+ #define JODY_HASH_API
+#else
+ #define JODY_HASH_API JODY_HASH_EXPORT
+#endif
+
+/* jodyhash-wide is a separate variant with its own version: every
+ * 64-byte stripe of input feeds JODY_HASH_WIDE_LANES independent hash
+ * chains (one per jodyhash_t in the stripe) which are folded into the
+ * hash with the normal algorithm at the end, so SIMD code can run the
+ * whole loop in vector registers. Whatever is left over after the last
+ * full stripe is hashed normally, so short inputs hash the same as
+ * with jody_block_hash(). The fold makes each jody_block_hash_wide()
+ * call a complete hash, so it can't be chained like jody_block_hash();
+ * data that comes in pieces goes through jodyhash_wide_state instead. */
+#define JODY_HASH_WIDE_VERSION 1
+#define JODY_HASH_WIDE_STRIPE 64
+#define JODY_HASH_WIDE_LANES (JODY_HASH_WIDE_STRIPE / sizeof(jodyhash_t))
+
 /* DO NOT modify shifts/contants unless you know what you're doing. They were
  * chosen after lots of testing. Changes will likely cause lots of hash
  * collisions. The vectorized versions also use constants that have this value
@@ -36,7 +111,9 @@ extern "C" {
 /* The tail mask table is used for block sizes that are
  * indivisible by the width of a jodyhash_t. It is ANDed with the
  * final jodyhash_t-sized element to zero out data in the buffer
- * that is not part of the data to be hashed. */
+ * that is not part of the data to be hashed. Little-endian CPUs
+ * load only the bytes that are part of the data instead (see
+ * jh_tail_load() below); the result is the same. */
 
 /* Set hash parameters based on requested hash width */
 #if JODY_HASH_WIDTH == 64
@@ -91,9 +168,286 @@ static const jodyhash_t tail_mask[] = {
 #define JH_ROL2(a) (jodyhash_t)(a << JH_SHIFT2 | (a >> ((sizeof(jodyhash_t) * 8) - JH_SHIFT2)))
 #define JH_ROR2(a) (jodyhash_t)(a >> JH_SHIFT2 | (a << ((sizeof(jodyhash_t) * 8) - JH_SHIFT2)))
 
+/* jodyhash128 runs a second hash chain with its own shift and constant
+ * next to the normal one, in the same pass over the data; the low half
+ * of the result is the normal 64-bit jodyhash. Like the shift and
+ * constant above, the second pair was picked by testing: the same shift
+ * with another constant gives a high half that follows the low half far
+ * too closely to be worth anything. 64-bit width only. */
+#if JODY_HASH_WIDTH == 64
+#define JODY_HASH128_VERSION 1
+#define JODY_HASH128_SHIFT 18
+#define JODY_HASH128_CONSTANT 0x9e3779b97f4a7c15ULL
+
+typedef struct {
+	uint64_t lo;
+	uint64_t hi;
+} jodyhash128_t;
+
+#define JH128_SHIFT2 ((JODY_HASH128_SHIFT * 2) - (((JODY_HASH128_SHIFT * 2) > 64) * 64))
+#define JODY_HASH128_CONSTANT_ROR2  (JODY_HASH128_CONSTANT >> JH128_SHIFT2 | (JODY_HASH128_CONSTANT << (64 - JH128_SHIFT2)))
+#define JH128_ROR(a)  (uint64_t)((a >> JODY_HASH128_SHIFT) | (a << (64 - JODY_HASH128_SHIFT)))
+#define JH128_ROL2(a) (uint64_t)(a << JH128_SHIFT2 | (a >> (64 - JH128_SHIFT2)))
+#endif /* JODY_HASH_WIDTH == 64 */
+
+
+/* Streaming: data that arrives in pieces of any size hashes the same as
+ * one jody_block_hash() call over all of it. Whole words go straight to
+ * jody_block_hash(); the few bytes of a partial word are kept in the
+ * state until the next piece completes the word (or until the end). */
+typedef struct {
+	jodyhash_t hash;
+	jodyhash_t partial;
+	size_t partial_len;
+} jodyhash_state;
+
+extern JODY_HASH_API int jody_block_hash(jodyhash_t *data, jodyhash_t *hash, const size_t count);
+extern JODY_HASH_API int jody_hash_init(jodyhash_state *state);
+extern JODY_HASH_API int jody_hash_update(jodyhash_state *state, const void *data, const size_t count);
+extern JODY_HASH_API int jody_hash_final(const jodyhash_state *state, jodyhash_t *hash);
+/* Streaming for jodyhash-wide: the lanes and a partial stripe are kept
+ * between pieces, so the result is the same as one jody_block_hash_wide()
+ * call over all of the data starting from 'hash' */
+typedef struct {
+	jodyhash_t hash;
+	jodyhash_t lanes[JODY_HASH_WIDE_LANES];
+	jodyhash_t partial[JODY_HASH_WIDE_LANES];
+	size_t partial_len;
+	size_t stripes;
+} jodyhash_wide_state;
+
+extern JODY_HASH_API int jody_hash_wide_init(jodyhash_wide_state *state);
+extern JODY_HASH_API int jody_hash_wide_update(jodyhash_wide_state *state, const void *data, const size_t count);
+extern JODY_HASH_API int jody_hash_wide_final(const jodyhash_wide_state *state, jodyhash_t *hash);
+/* Scatter-gather: hashes the iovcnt buffers as if they were one block
+ * (struct iovec is in <sys/uio.h>; not available on Windows) */
+struct iovec;
+extern JODY_HASH_API int jody_block_hash_iov(const struct iovec *iov, int iovcnt, jodyhash_t *hash);
+/* jody_rolling_hash() with 4 KiB blocks, without threads */
+extern JODY_HASH_API int jody_rolling_block_hash(jodyhash_t *data, jodyhash_t *hash, const size_t count);
+extern JODY_HASH_API int jody_block_hash_wide(jodyhash_t *data, jodyhash_t *hash, const size_t count);
+extern JODY_HASH_API int jody_block_hash_multi(const void * const *bufs, const size_t *lens, jodyhash_t *out, const size_t n);
+extern JODY_HASH_API int jody_str_hash(const char *s, jodyhash_t *hash, size_t *len_out);
+extern JODY_HASH_API int jody_line_hash(const char *s, jodyhash_t *hash, size_t *len_out);
+extern JODY_HASH_API const char *jody_hash_kernel(size_t *threshold);
+/* Seeded hashes, and k hashes per key (for Bloom filters and sketches)
+ * from a single pass over the data; these are not plain jodyhash hashes */
+extern JODY_HASH_API int jody_block_hash_seeded(const void *data, const size_t count, const uint64_t seed, jodyhash_t *hash);
+extern JODY_HASH_API int jody_block_hash_k(const void *data, const size_t count, const uint64_t seed, jodyhash_t *out, const unsigned int k);
+/* jody_block_hash() for each width, whatever JODY_HASH_WIDTH is; each
+ * one has its own constants, tail handling and SIMD kernels */
+extern JODY_HASH_EXPORT int jody_block_hash64(uint64_t *data, uint64_t *hash, const size_t count);
+extern JODY_HASH_EXPORT int jody_block_hash32(uint32_t *data, uint32_t *hash, const size_t count);
+extern JODY_HASH_EXPORT int jody_block_hash16(uint16_t *data, uint16_t *hash, const size_t count);
+#if JODY_HASH_WIDTH == 64
+extern JODY_HASH_API int jody_block_hash128(jodyhash_t *data, jodyhash128_t *hash, const size_t count);
+#endif
+
+/* Tree hashing: the data is cut into leaves of leafsize bytes (the last
+ * one can be shorter; no data is one empty leaf), each leaf is hashed
+ * with jody_block_hash() from zero, and the leaf hashes are hashed
+ * together in pairs, level by level, until one is left. A node at the
+ * end of a level without a partner goes up to the next level as it is.
+ * Two child hashes are hashed as one two-word block with
+ * JODY_HASH_CONSTANT as the initial hash. leafsize must be a multiple of
+ * sizeof(jodyhash_t). Leaves are hashed on 'threads' threads; 0 means
+ * one per CPU (or JODY_HASH_THREADS from the environment). */
+#define JODY_TREE_VERSION 1
+#define JODY_TREE_LEAVES(count, leafsize) ((count) == 0 ? 1 : ((count) + (leafsize) - 1) / (leafsize))
+extern JODY_HASH_API int jody_tree_hash(const void *data, const size_t count, const size_t leafsize,
+		const unsigned int threads, jodyhash_t *root);
+/* The two halves of jody_tree_hash(), for hashing data a piece at a time
+ * or hashing only the leaves that changed: leaves[] needs room for
+ * JODY_TREE_LEAVES(count, leafsize) hashes */
+extern JODY_HASH_API int jody_tree_leaves(const void *data, const size_t count, const size_t leafsize,
+		const unsigned int threads, jodyhash_t *leaves);
+extern JODY_HASH_API int jody_tree_root(const jodyhash_t *leaves, const size_t n, jodyhash_t *root);
+
+/* Rolling hash: the jody_block_hash() from zero of each block of
+ * blocksize bytes (the last one can be shorter) is XORed into *hash.
+ * Since XOR doesn't care about order, the data can be passed in pieces
+ * that are multiples of blocksize, and big inputs are split between
+ * 'threads' threads (0 means one per CPU, as for tree hashing). */
+#define JODY_ROLLING_BLOCKSIZE 4096
+extern JODY_HASH_API int jody_rolling_hash(const void *data, const size_t count, const size_t blocksize,
+		const unsigned int threads, jodyhash_t *hash);
+
+/* Asynchronous hashing: jody_hash_submit() queues buf to be hashed with
+ * jody_block_hash() from zero by a pool of worker threads and returns
+ * right away (non-zero if the job couldn't be queued). callback(ctx,
+ * hash, error) is called on a worker thread when it is done; buf must
+ * stay around until then. Short buffers are hashed several at a time.
+ * jody_hash_pending() is the number of jobs whose callbacks haven't
+ * returned yet and jody_hash_wait() waits for it to be zero. A callback
+ * must not wait for completion: jody_hash_wait() returns right away when
+ * called from one, since the job it runs for is still pending. There is
+ * one worker per CPU (or JODY_HASH_THREADS); with NO_THREADS the job is
+ * done before jody_hash_submit() returns. */
+typedef void (*jody_hash_callback_t)(void *ctx, const jodyhash_t hash, const int error);
+extern JODY_HASH_API int jody_hash_submit(const void *buf, const size_t len, const jody_hash_callback_t callback, void *ctx);
+extern JODY_HASH_API size_t jody_hash_pending(void);
+extern JODY_HASH_API void jody_hash_wait(void);
+
+/* Content-defined chunking: chunk boundaries are picked by the data
+ * itself (a Gear rolling hash over the last JODY_CDC_WINDOW bytes), so
+ * inserting or deleting bytes only changes the chunks around the edit
+ * and the rest still deduplicate. Chunks are at least min_size and at
+ * most max_size bytes; cut points are harder to hit before avg_size and
+ * easier after it (FastCDC's normalized chunking), which keeps most
+ * chunks near avg_size. min_size must be at least JODY_CDC_MIN_SIZE and
+ * less than avg_size, which can't be more than max_size; zeroes pick
+ * 8K for avg_size, avg_size / 4 for min_size and avg_size * 8 for
+ * max_size. Each chunk is fingerprinted with jody_block_hash() from 0. */
+#define JODY_CDC_VERSION 1
+#define JODY_CDC_WINDOW 32
+#define JODY_CDC_MIN_SIZE 64
+typedef struct {
+	size_t min_size;
+	size_t avg_size;
+	size_t max_size;
+	uint32_t mask_s;
+	uint32_t mask_l;
+} jody_cdc_t;
 
-extern int jody_block_hash(jodyhash_t *data, jodyhash_t *hash, const size_t count);
-extern int jody_rolling_block_hash(jodyhash_t *data, jodyhash_t *hash, const size_t count);
+typedef struct {
+	uint64_t offset;
+	size_t length;
+	jodyhash_t hash;
+} jody_chunk_t;
+
+extern JODY_HASH_API int jody_cdc_init(jody_cdc_t *cdc, size_t min_size, size_t avg_size, size_t max_size);
+/* Length of the chunk at the start of data, or 0 if more data is needed
+ * to find its end; 'final' means there is no more data after count */
+extern JODY_HASH_API size_t jody_cdc_next(const jody_cdc_t *cdc, const void *data, const size_t count, const int final);
+/* Cut data into at most max_chunks chunks and fingerprint them; returns
+ * how many there are and sets *used to the bytes they cover (offsets are
+ * from data). Without 'final' the bytes after *used must be passed
+ * again, with more data after them, to get the chunks they start. */
+extern JODY_HASH_API size_t jody_cdc_chunks(const jody_cdc_t *cdc, const void *data, const size_t count, const int final,
+		jody_chunk_t *chunks, const size_t max_chunks, size_t *used);
+
+/* rsync-style deltas: the signature of the old data has a weak rolling
+ * sum (rsync's) and a jody_block_hash() from 0 for every block of
+ * blocksize bytes, the last one possibly shorter. jody_delta() finds
+ * whole blocks of the old data at any offset in the new data (and the
+ * short last block at the end of it) and hands the new data to emit() as
+ * copies of old blocks and literal runs in between, in order. Offsets are from data; without 'final' the bytes
+ * from *used on must be passed again, with more data after them. */
+#define JODY_DELTA_VERSION 1
+#define JODY_DELTA_BLOCKS(count, blocksize) (((count) + (blocksize) - 1) / (blocksize))
+#define JODY_DELTA_LITERAL SIZE_MAX
+typedef struct {
+	uint32_t weak;
+	jodyhash_t strong;
+} jody_block_sig_t;
+
+/* The signature's whole blocks in a hash table on the weak sum; sigs
+ * must stay around while the index is used */
+struct jh_delta_slot;
+typedef struct {
+	const jody_block_sig_t *sigs;
+	size_t nblocks;
+	size_t blocksize;
+	size_t tail;
+	struct jh_delta_slot *slots;
+	uint64_t *filter;
+	size_t mask;
+} jody_delta_index_t;
+
+/* 'block' is the old block that the new data at offset is a copy of
+ * (length is the size of that block), or JODY_DELTA_LITERAL; non-zero stops */
+typedef int (*jody_delta_emit_t)(void *arg, const size_t offset, const size_t length, const size_t block);
+
+extern JODY_HASH_API uint32_t jody_weak_sum(const void *data, const size_t count);
+/* sigs[] needs room for JODY_DELTA_BLOCKS(count, blocksize) entries */
+extern JODY_HASH_API int jody_block_signature(const void *data, const size_t count, const size_t blocksize, jody_block_sig_t *sigs);
+/* nblocks and size are the block count and size of the old data */
+extern JODY_HASH_API int jody_delta_index(jody_delta_index_t *index, const jody_block_sig_t *sigs, const size_t nblocks,
+		const size_t blocksize, const uint64_t size);
+extern JODY_HASH_API void jody_delta_index_free(jody_delta_index_t *index);
+extern JODY_HASH_API int jody_delta(const jody_delta_index_t *index, const void *data, const size_t count, const int final,
+		const jody_delta_emit_t emit, void *arg, size_t *used);
+
+/* Loading a partial last word without reading past the end of the data
+ *
+ * The rem (1 to sizeof(jodyhash_t) - 1) bytes at p become the low bytes
+ * of a word, which is what masking a whole word with tail_mask[rem] gives
+ * on a little-endian CPU. When 'overlap' is set there is a whole word
+ * before p + rem to load from, so the word that ends at p + rem is loaded
+ * (overlapping the word before it) and shifted down; shorter data is put
+ * together from a couple of smaller loads. Little-endian only: elsewhere
+ * the tail is still read as a whole word, so buffers must be padded. */
+#if defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define JH_TAIL_IN_BOUNDS
+static inline jodyhash_t jh_tail_load(const unsigned char *p, const size_t rem, const int overlap)
+{
+	jodyhash_t word;
+#if JODY_HASH_WIDTH == 64
+	uint32_t a, b;
+#endif
+
+	if (overlap) {
+		memcpy(&word, p + rem - sizeof(jodyhash_t), sizeof(word));
+		return (jodyhash_t)(word >> ((sizeof(jodyhash_t) - rem) * 8));
+	}
+#if JODY_HASH_WIDTH == 64
+	if (rem >= 4) {
+		memcpy(&a, p, 4);
+		memcpy(&b, p + rem - 4, 4);
+		return (jodyhash_t)a | ((jodyhash_t)b << ((rem - 4) * 8));
+	}
+#endif
+	/* 1 to 3 bytes: first, middle and last (which may be the same one) */
+	return (jodyhash_t)((jodyhash_t)p[0] | ((jodyhash_t)p[rem >> 1] << ((rem >> 1) * 8))
+			| ((jodyhash_t)p[rem - 1] << ((rem - 1) * 8)));
+}
+#endif /* little-endian */
+
+
+/* Inline small-key hashing
+ *
+ * jody_block_hash_small() hashes exactly like jody_block_hash(), but keys
+ * of up to JODY_HASH_SMALL_MAX bytes are hashed right here with no call,
+ * no dispatch and no tail mask table; longer keys go to jody_block_hash().
+ * The key doesn't need to be aligned and nothing past its end is read
+ * (see jh_tail_load(); other CPUs just call jody_block_hash()). */
+#define JODY_HASH_SMALL_MAX 32
+
+static inline int jody_block_hash_small(const void *data, jodyhash_t *hash, const size_t count)
+{
+#ifdef JH_TAIL_IN_BOUNDS
+	const unsigned char *p = (const unsigned char *)data;
+	const size_t rem = count & (sizeof(jodyhash_t) - 1);
+	jodyhash_t element, element2;
+	size_t i;
+
+	if (count > JODY_HASH_SMALL_MAX) return jody_block_hash((jodyhash_t *)(uintptr_t)data, hash, count);
+
+	for (i = sizeof(jodyhash_t); i <= count; i += sizeof(jodyhash_t)) {
+		memcpy(&element, p + i - sizeof(jodyhash_t), sizeof(element));
+		element2 = JH_ROR(element);
+		element2 ^= (jodyhash_t)JODY_HASH_CONSTANT_ROR2;
+		element += JODY_HASH_CONSTANT;
+		*hash += element;
+		*hash ^= element2;
+		*hash = JH_ROL2(*hash);
+		*hash += element;
+	}
+
+	if (rem == 0) return 0;
+	element = jh_tail_load(p + count - rem, rem, count > sizeof(jodyhash_t));
+	element2 = JH_ROR(element);
+	element2 ^= (jodyhash_t)JODY_HASH_CONSTANT_ROR2;
+	element += JODY_HASH_CONSTANT;
+	*hash += element;
+	*hash ^= element2;
+	*hash = JH_ROL2(*hash);
+	*hash += element2;
+	return 0;
+#else
+	return jody_block_hash((jodyhash_t *)(uintptr_t)data, hash, count);
+#endif /* JH_TAIL_IN_BOUNDS */
+}
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,268 @@
+/* Jody Bruchon's fast hashing function (C++ header)
+ * See jody_hash.c for license information
+ *
+ * The jodyhash algorithm as C++17 templates, so hashes of string literals
+ * can be worked out by the compiler:
+ *
+ *   switch (jody::hash::of(route)) {
+ *   case "GET /"_jh: ...
+ *
+ * jody::basic_hash is templated on the word type (which sets the width),
+ * the shift and the constant. jody::hash16, hash32 and hash64 are the
+ * three widths with the parameters jody_hash.h uses by default, and
+ * jody::hash is the one this build of jody_hash.c is for. When the
+ * compiler is not working the hash out at compile time and the parameters
+ * match the C library, the C library (with its SIMD kernels) does the
+ * work instead.
+ *
+ * For hash tables there are jody::hashed_string and hashed_string_view,
+ * which carry their hash around with them, and jody::string_hash and
+ * string_equal, which hash and compare all of std::string, string_view,
+ * C strings and the hashed types alike (is_transparent), so lookups with
+ * any of them don't build a temporary std::string (C++20 for unordered
+ * containers) and a hashed key is never hashed again:
+ *
+ *   std::unordered_map<jody::hashed_string, int, jody::string_hash,
+ *                      jody::string_equal> map;
+ *
+ * Words are put together from the bytes little-endian first, which is
+ * what the C code does on every little-endian CPU; on big-endian CPUs the
+ * C library isn't used, so the hashes still come out the same. */
+
+#ifndef JODY_HASH_HPP
+#define JODY_HASH_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include "jody_hash.h"
+
+/* Is this being worked out at compile time? Without a way to tell, the
+ * constexpr code is used at run time too */
+#if defined __cpp_lib_is_constant_evaluated
+ #define JH_CONSTANT_EVALUATED() std::is_constant_evaluated()
+#elif defined __has_builtin
+ #if __has_builtin(__builtin_is_constant_evaluated)
+  #define JH_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+ #endif
+#endif
+#if !defined JH_CONSTANT_EVALUATED && defined __GNUC__ && !defined __clang__ && __GNUC__ >= 9
+ #define JH_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#endif
+
+namespace jody {
+
+template <typename T, unsigned Shift, T Constant>
+class basic_hash {
+	static_assert(std::is_same_v<T, std::uint16_t> || std::is_same_v<T, std::uint32_t>
+			|| std::is_same_v<T, std::uint64_t>, "jodyhash words are 16, 32 or 64 bits");
+	static_assert(Shift > 0 && Shift < sizeof(T) * 8, "shift must be less than the width");
+
+public:
+	using value_type = T;
+	static constexpr unsigned width = sizeof(T) * 8;
+	static constexpr unsigned shift = Shift;
+	static constexpr T constant = Constant;
+
+	/* The same as jody_block_hash(data, &seed, size) */
+	static constexpr T of(std::string_view data, T seed = 0) noexcept
+	{
+#ifdef JH_CONSTANT_EVALUATED
+ #ifdef JH_TAIL_IN_BOUNDS
+		if constexpr (is_c_hash) {
+			if (!JH_CONSTANT_EVALUATED()) {
+				jodyhash_t h = seed;
+
+				jody_block_hash_small(data.data(), &h, data.size());
+				return h;
+			}
+		}
+ #endif
+#endif
+		return hash_words(data, seed);
+	}
+
+	constexpr T operator()(std::string_view data) const noexcept
+	{
+		return of(data);
+	}
+
+private:
+	static constexpr unsigned shift2 = (Shift * 2 > width) ? Shift * 2 - width : Shift * 2;
+	static constexpr bool is_c_hash = std::is_same_v<T, jodyhash_t>
+			&& Shift == JODY_HASH_SHIFT && Constant == (T)JODY_HASH_CONSTANT;
+
+	static constexpr T ror(const T a, const unsigned n) noexcept
+	{
+		return (T)((a >> n) | (a << (width - n)));
+	}
+
+	static constexpr T rol(const T a, const unsigned n) noexcept
+	{
+		return (T)((a << n) | (a >> (width - n)));
+	}
+
+	/* n bytes at p, first byte lowest */
+	static constexpr T load(const char *p, const std::size_t n) noexcept
+	{
+		T word = 0;
+
+		for (std::size_t i = 0; i < n; i++)
+			word = (T)(word | (T)((T)(unsigned char)p[i] << (i * 8)));
+		return word;
+	}
+
+	static constexpr T hash_words(const std::string_view data, T h) noexcept
+	{
+		const T s_constant = ror(Constant, shift2);
+		const std::size_t rem = data.size() % sizeof(T);
+		std::size_t i = 0;
+		T element = 0, element2 = 0;
+
+		for (; i + sizeof(T) <= data.size(); i += sizeof(T)) {
+			element = load(data.data() + i, sizeof(T));
+			element2 = (T)(ror(element, Shift) ^ s_constant);
+			element = (T)(element + Constant);
+			h = (T)(h + element);
+			h = (T)(h ^ element2);
+			h = rol(h, shift2);
+			h = (T)(h + element);
+		}
+		if (rem) {
+			element = load(data.data() + i, rem);
+			element2 = (T)(ror(element, Shift) ^ s_constant);
+			element = (T)(element + Constant);
+			h = (T)(h + element);
+			h = (T)(h ^ element2);
+			h = rol(h, shift2);
+			h = (T)(h + element2);
+		}
+		return h;
+	}
+};
+
+/* The parameters jody_hash.h uses for each width by default */
+using hash64 = basic_hash<std::uint64_t, 14, 0x71812e0f5463d3c8ULL>;
+using hash32 = basic_hash<std::uint32_t, 14, 0x8748ee5dU>;
+using hash16 = basic_hash<std::uint16_t, 14, 0x1f5bU>;
+
+/* The one that matches this build of the C library */
+using hash = basic_hash<jodyhash_t, JODY_HASH_SHIFT, (jodyhash_t)JODY_HASH_CONSTANT>;
+
+namespace literals {
+/* "key"_jh is jody::hash::of("key"), worked out at compile time */
+constexpr jodyhash_t operator""_jh(const char *s, const std::size_t n) noexcept
+{
+	return hash::of(std::string_view(s, n));
+}
+} /* namespace literals */
+
+/* A string_view and its jody::hash, worked out once */
+class hashed_string_view {
+public:
+	constexpr hashed_string_view() noexcept : str_(), hash_(hash::of(std::string_view())) {}
+	constexpr hashed_string_view(const char *s) noexcept : str_(s), hash_(hash::of(str_)) {}
+	constexpr hashed_string_view(const std::string_view s) noexcept : str_(s), hash_(hash::of(s)) {}
+	hashed_string_view(const std::string &s) noexcept : str_(s), hash_(hash::of(str_)) {}
+
+	constexpr std::string_view str() const noexcept { return str_; }
+	constexpr jodyhash_t jodyhash() const noexcept { return hash_; }
+	constexpr operator std::string_view() const noexcept { return str_; }
+
+	friend constexpr bool operator==(const hashed_string_view &a, const hashed_string_view &b) noexcept
+	{
+		return a.hash_ == b.hash_ && a.str_ == b.str_;
+	}
+	friend constexpr bool operator!=(const hashed_string_view &a, const hashed_string_view &b) noexcept
+	{
+		return !(a == b);
+	}
+
+private:
+	friend class hashed_string;
+	constexpr hashed_string_view(const std::string_view s, const jodyhash_t h) noexcept : str_(s), hash_(h) {}
+
+	std::string_view str_;
+	jodyhash_t hash_;
+};
+
+/* A std::string and its jody::hash, worked out once */
+class hashed_string {
+public:
+	hashed_string() : str_(), hash_(hash::of(str_)) {}
+	hashed_string(const char *s) : str_(s), hash_(hash::of(str_)) {}
+	hashed_string(const std::string_view s) : str_(s), hash_(hash::of(s)) {}
+	hashed_string(std::string s) : str_(std::move(s)), hash_(hash::of(str_)) {}
+	hashed_string(const hashed_string_view s) : str_(s.str()), hash_(s.jodyhash()) {}
+
+	const std::string &str() const noexcept { return str_; }
+	jodyhash_t jodyhash() const noexcept { return hash_; }
+	operator std::string_view() const noexcept { return str_; }
+	operator hashed_string_view() const noexcept { return hashed_string_view(str_, hash_); }
+
+	friend bool operator==(const hashed_string &a, const hashed_string &b) noexcept
+	{
+		return a.hash_ == b.hash_ && a.str_ == b.str_;
+	}
+	friend bool operator!=(const hashed_string &a, const hashed_string &b) noexcept
+	{
+		return !(a == b);
+	}
+
+private:
+	std::string str_;
+	jodyhash_t hash_;
+};
+
+/* Hash functor for unordered containers: strings of any kind hash the
+ * same, and the hashed types hand over the hash they already have */
+struct string_hash {
+	using is_transparent = void;
+
+	std::size_t operator()(const std::string_view s) const noexcept { return hash::of(s); }
+	std::size_t operator()(const std::string &s) const noexcept { return hash::of(s); }
+	std::size_t operator()(const char *s) const noexcept { return hash::of(s); }
+	std::size_t operator()(const hashed_string_view &s) const noexcept { return s.jodyhash(); }
+	std::size_t operator()(const hashed_string &s) const noexcept { return s.jodyhash(); }
+};
+
+/* Equality to go with string_hash: any two of the string kinds compare
+ * as string_views, after the hashes if both have one */
+struct string_equal {
+	using is_transparent = void;
+
+	template <typename A, typename B>
+	constexpr bool operator()(const A &a, const B &b) const noexcept
+	{
+		if constexpr (is_hashed<A> && is_hashed<B>)
+			if (a.jodyhash() != b.jodyhash()) return false;
+		return std::string_view(a) == std::string_view(b);
+	}
+
+private:
+	template <typename T>
+	static constexpr bool is_hashed = std::is_same_v<T, hashed_string> || std::is_same_v<T, hashed_string_view>;
+};
+
+/* Known hashes from the C code; if these don't hold, neither does
+ * anything else in here */
+static_assert(hash64::of("") == 0);
+static_assert(hash64::of("a") == 0xcc804fd4db76621dULL);
+static_assert(hash64::of("jodyhash") == 0xaefc43dd2fee4455ULL);
+static_assert(hash64::of("The quick brown fox jumps over the lazy dog") == 0xd82b7084f5f871a7ULL);
+static_assert(hash64::of("jodyhash", 0x71812e0f5463d3c8ULL) == 0xb5ee80b1b8d6553eULL);
+static_assert(hash32::of("a") == 0xe42f068eU);
+static_assert(hash32::of("jodyhash") == 0x027f213cU);
+static_assert(hash32::of("The quick brown fox jumps over the lazy dog") == 0xfc0ef216U);
+static_assert(hash32::of("jodyhash", 0x8748ee5dU) == 0x6303e829U);
+static_assert(hash16::of("a") == 0x92ed);
+static_assert(hash16::of("jodyhash") == 0x0272);
+static_assert(hash16::of("The quick brown fox jumps over the lazy dog") == 0x34d6);
+static_assert(hash16::of("jodyhash", 0x1f5b) == 0xa1f9);
+
+} /* namespace jody */
+
+#endif	/* JODY_HASH_HPP */
@@ -0,0 +1,284 @@
+/* Jody Bruchon's fast hashing function: asynchronous hashing
+ *
+ * jody_hash_submit() puts a buffer on the queue of one of a set of
+ * worker threads and returns at once; the worker hashes it and calls the
+ * callback. Each worker has its own queue (so submitters spread out over
+ * several locks) and an idle worker takes work from the others. Short
+ * buffers are taken off a queue in batches and hashed together with
+ * jody_block_hash_multi(), which hashes several at once in vector lanes.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#ifndef NO_THREADS
+ #include <pthread.h>
+#endif
+#include "jody_hash.h"
+#include "jody_hash_pool.h"
+
+#ifdef NO_THREADS
+/* Without threads everything is hashed right away */
+extern int jody_hash_submit(const void *buf, const size_t len, const jody_hash_callback_t callback, void *ctx)
+{
+	jodyhash_t hash = 0;
+	int error;
+
+	error = jody_block_hash((jodyhash_t *)(uintptr_t)buf, &hash, len);
+	if (callback != NULL) callback(ctx, hash, error);
+	return 0;
+}
+
+extern size_t jody_hash_pending(void)
+{
+	return 0;
+}
+
+extern void jody_hash_wait(void)
+{
+	return;
+}
+
+#else
+
+/* Buffers up to this size are hashed in batches of up to JH_ASYNC_BATCH */
+#define JH_ASYNC_SMALL 256
+#define JH_ASYNC_BATCH 32
+/* Jobs are allocated this many at a time and never freed, only reused */
+#define JH_ASYNC_SLAB 256
+
+struct jh_async_job {
+	const void *buf;
+	size_t len;
+	jody_hash_callback_t callback;
+	void *ctx;
+	struct jh_async_job *next;
+};
+
+/* A worker's queue and its batch scratch space, which only it uses */
+struct jh_async_worker {
+	pthread_mutex_t lock;
+	struct jh_async_job *head;
+	struct jh_async_job *tail;
+	unsigned int id;
+	struct jh_async_job *batch[JH_ASYNC_BATCH];
+	const void *bufs[JH_ASYNC_BATCH];
+	size_t lens[JH_ASYNC_BATCH];
+	jodyhash_t out[JH_ASYNC_BATCH];
+};
+
+static struct jh_async_worker *jh_async_workers = NULL;
+static unsigned int jh_async_nworkers = 0;
+static pthread_mutex_t jh_async_start_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Unused jobs */
+static struct jh_async_job *jh_async_free = NULL;
+static pthread_mutex_t jh_async_free_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Workers with nothing to do sleep on jh_async_wake; 'queued' is the
+ * number of jobs on all queues and 'idle' how many workers are asleep.
+ * 'pending' counts jobs from submission until their callback returns. */
+static size_t jh_async_queued = 0;
+static unsigned int jh_async_idle = 0;
+static size_t jh_async_pending = 0;
+static unsigned int jh_async_next = 0;
+static pthread_mutex_t jh_async_idle_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jh_async_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t jh_async_done = PTHREAD_COND_INITIALIZER;
+/* Set in the workers: a callback that waited for all jobs to finish would
+ * be waiting for its own, so jody_hash_wait() returns right away there */
+static _Thread_local int jh_async_inside = 0;
+
+
+/* Take one big job or a batch of small ones from the front of a queue */
+static unsigned int jh_async_take(struct jh_async_worker *self, struct jh_async_worker *from)
+{
+	struct jh_async_job *job;
+	unsigned int n = 0;
+
+	/* A quick look without the lock; the head is only changed with it */
+	if (__atomic_load_n(&from->head, __ATOMIC_RELAXED) == NULL) return 0;
+	pthread_mutex_lock(&from->lock);
+	while ((job = from->head) != NULL && n < JH_ASYNC_BATCH) {
+		if (n > 0 && job->len > JH_ASYNC_SMALL) break;
+		__atomic_store_n(&from->head, job->next, __ATOMIC_RELAXED);
+		self->batch[n++] = job;
+		if (job->len > JH_ASYNC_SMALL) break;
+	}
+	if (from->head == NULL) from->tail = NULL;
+	pthread_mutex_unlock(&from->lock);
+	if (n > 0) __atomic_sub_fetch(&jh_async_queued, n, __ATOMIC_SEQ_CST);
+	return n;
+}
+
+/* Hash a batch, call the callbacks and put the jobs back on the free list */
+static void jh_async_run(struct jh_async_worker *self, const unsigned int n)
+{
+	int error = 0;
+
+	if (n == 1) {
+		self->out[0] = 0;
+		error = jody_block_hash((jodyhash_t *)(uintptr_t)self->batch[0]->buf, &self->out[0], self->batch[0]->len);
+	} else {
+		for (unsigned int i = 0; i < n; i++) {
+			self->bufs[i] = self->batch[i]->buf;
+			self->lens[i] = self->batch[i]->len;
+			self->out[i] = 0;
+		}
+		error = jody_block_hash_multi(self->bufs, self->lens, self->out, n);
+	}
+	for (unsigned int i = 0; i < n; i++) {
+		if (self->batch[i]->callback != NULL) self->batch[i]->callback(self->batch[i]->ctx, self->out[i], error);
+		if (i > 0) self->batch[i - 1]->next = self->batch[i];
+	}
+	pthread_mutex_lock(&jh_async_free_lock);
+	self->batch[n - 1]->next = jh_async_free;
+	jh_async_free = self->batch[0];
+	pthread_mutex_unlock(&jh_async_free_lock);
+
+	if (__atomic_sub_fetch(&jh_async_pending, n, __ATOMIC_SEQ_CST) == 0) {
+		pthread_mutex_lock(&jh_async_idle_lock);
+		pthread_cond_broadcast(&jh_async_done);
+		pthread_mutex_unlock(&jh_async_idle_lock);
+	}
+	return;
+}
+
+static void *jh_async_worker(void *arg)
+{
+	struct jh_async_worker *self = (struct jh_async_worker *)arg;
+	unsigned int n, nworkers;
+
+	jh_async_inside = 1;
+	for (;;) {
+		/* Own queue first, then the others */
+		n = jh_async_take(self, self);
+		nworkers = __atomic_load_n(&jh_async_nworkers, __ATOMIC_ACQUIRE);
+		for (unsigned int i = 1; n == 0 && i < nworkers; i++)
+			n = jh_async_take(self, &jh_async_workers[(self->id + i) % nworkers]);
+		if (n > 0) {
+			jh_async_run(self, n);
+			continue;
+		}
+		pthread_mutex_lock(&jh_async_idle_lock);
+		__atomic_add_fetch(&jh_async_idle, 1, __ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&jh_async_queued, __ATOMIC_SEQ_CST) == 0)
+			pthread_cond_wait(&jh_async_wake, &jh_async_idle_lock);
+		__atomic_sub_fetch(&jh_async_idle, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&jh_async_idle_lock);
+	}
+	return NULL;
+}
+
+/* Start the workers (one per CPU, or JODY_HASH_THREADS) */
+static int jh_async_start(void)
+{
+	struct jh_async_worker *workers;
+	pthread_t thread;
+	unsigned int n = jh_pool_threads(), started = 0;
+
+	pthread_mutex_lock(&jh_async_start_lock);
+	if (jh_async_nworkers > 0) {
+		pthread_mutex_unlock(&jh_async_start_lock);
+		return 0;
+	}
+	workers = (struct jh_async_worker *)calloc(n, sizeof(struct jh_async_worker));
+	if (workers == NULL) {
+		pthread_mutex_unlock(&jh_async_start_lock);
+		return 1;
+	}
+	/* Calibrate before the workers start so they don't skew the timings */
+	jody_hash_kernel(NULL);
+	jh_async_workers = workers;
+	for (unsigned int i = 0; i < n; i++) {
+		pthread_mutex_init(&workers[i].lock, NULL);
+		workers[i].id = i;
+	}
+	for (; started < n; started++) {
+		if (pthread_create(&thread, NULL, jh_async_worker, &workers[started]) != 0) break;
+		pthread_detach(thread);
+	}
+	/* Until this is set the workers only look at their own queues */
+	if (started > 0) __atomic_store_n(&jh_async_nworkers, started, __ATOMIC_RELEASE);
+	else free(workers);
+	pthread_mutex_unlock(&jh_async_start_lock);
+	return (started == 0);
+}
+
+static struct jh_async_job *jh_async_alloc(void)
+{
+	struct jh_async_job *job, *slab;
+
+	pthread_mutex_lock(&jh_async_free_lock);
+	if (jh_async_free == NULL) {
+		slab = (struct jh_async_job *)malloc(JH_ASYNC_SLAB * sizeof(struct jh_async_job));
+		if (slab == NULL) {
+			pthread_mutex_unlock(&jh_async_free_lock);
+			return NULL;
+		}
+		for (size_t i = 0; i < JH_ASYNC_SLAB - 1; i++) slab[i].next = &slab[i + 1];
+		slab[JH_ASYNC_SLAB - 1].next = NULL;
+		jh_async_free = slab;
+	}
+	job = jh_async_free;
+	jh_async_free = job->next;
+	pthread_mutex_unlock(&jh_async_free_lock);
+	return job;
+}
+
+/* Queue a buffer to be hashed (see jody_hash.h) */
+extern int jody_hash_submit(const void *buf, const size_t len, const jody_hash_callback_t callback, void *ctx)
+{
+	struct jh_async_worker *worker;
+	struct jh_async_job *job;
+	unsigned int nworkers = __atomic_load_n(&jh_async_nworkers, __ATOMIC_ACQUIRE);
+
+	if (nworkers == 0) {
+		if (jh_async_start() != 0) return 1;
+		nworkers = __atomic_load_n(&jh_async_nworkers, __ATOMIC_ACQUIRE);
+	}
+	job = jh_async_alloc();
+	if (job == NULL) return 1;
+	job->buf = buf;
+	job->len = len;
+	job->callback = callback;
+	job->ctx = ctx;
+	job->next = NULL;
+
+	/* Counted before it is queued so that taking it can't come first */
+	__atomic_add_fetch(&jh_async_pending, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&jh_async_queued, 1, __ATOMIC_SEQ_CST);
+	worker = &jh_async_workers[__atomic_fetch_add(&jh_async_next, 1, __ATOMIC_RELAXED) % nworkers];
+	pthread_mutex_lock(&worker->lock);
+	if (worker->tail != NULL) worker->tail->next = job;
+	else __atomic_store_n(&worker->head, job, __ATOMIC_RELAXED);
+	worker->tail = job;
+	pthread_mutex_unlock(&worker->lock);
+
+	/* A worker that saw no jobs counted itself idle before it looked, so
+	 * either it sees this job or it is seen here and woken up */
+	if (__atomic_load_n(&jh_async_idle, __ATOMIC_SEQ_CST) > 0) {
+		pthread_mutex_lock(&jh_async_idle_lock);
+		pthread_cond_signal(&jh_async_wake);
+		pthread_mutex_unlock(&jh_async_idle_lock);
+	}
+	return 0;
+}
+
+extern size_t jody_hash_pending(void)
+{
+	return __atomic_load_n(&jh_async_pending, __ATOMIC_SEQ_CST);
+}
+
+extern void jody_hash_wait(void)
+{
+	if (jh_async_inside) return;
+	pthread_mutex_lock(&jh_async_idle_lock);
+	while (__atomic_load_n(&jh_async_pending, __ATOMIC_SEQ_CST) != 0)
+		pthread_cond_wait(&jh_async_done, &jh_async_idle_lock);
+	pthread_mutex_unlock(&jh_async_idle_lock);
+	return;
+}
+#endif /* NO_THREADS */
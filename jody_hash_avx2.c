@@ -20,69 +20,235 @@
 int jody_block_hash_avx2(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length)
 {
 	size_t vec_allocsize;
-	__m256i *aligned_data;
+	const __m256i *vec_data;
 	/* Regs used in groups of 3; 1=ROR/XOR work, 2=temp, 3=data+constant */
 	__m256i vx1, vx2, vx3;
 	__m256i avx_const, avx_ror2;
+	/* Chain state in merged form, see jh_hash_words() */
+	union UINT256 ep1, ep2;
+	jodyhash_t r = *hash, prev = 0;
+	jodyhash_t s0, f0;
+	const size_t prefetch = JH_PREFETCH_FOR(count);
 
 	/* Constants preload */
 	avx_const = _mm256_load_si256(&vec_constant.v256);
 	avx_ror2  = _mm256_load_si256(&vec_constant_ror2.v256);
 
-	/* How much memory do we need to align the data? */
+	/* Data is read in place with unaligned loads (see the SSE2 version) */
 	vec_allocsize = count & 0xffffffffffffffe0U;
-	/* Only alloc/copy if not already aligned */
-	if (((uintptr_t)*data & (uintptr_t)0x1fULL) != 0) {
-		aligned_data  = (__m256i *)aligned_alloc(32, vec_allocsize);
-		if (!aligned_data) return 1;
-		memcpy(aligned_data, *data, vec_allocsize);
-	} else aligned_data = (__m256i *)*data;
+	vec_data = (const __m256i *)*data;
 
 	for (size_t i = 0; i < (vec_allocsize / 32); i++) {
-		vx1  = _mm256_load_si256(&aligned_data[i]);
-		vx3  = _mm256_load_si256(&aligned_data[i]);
+		if (prefetch != 0) JH_PREFETCH_NTA((const char *)&vec_data[i] + prefetch);
+		vx3  = _mm256_loadu_si256(&vec_data[i]);
+		vx1  = vx3;
 
 		/* "element2" gets RORed (two logical shifts ORed together) */
-		vx1  = _mm256_srli_epi64(vx1, JODY_HASH_SHIFT);
-		vx2  = _mm256_slli_epi64(vx3, (64 - JODY_HASH_SHIFT));
+		vx1  = JH_AVX2_SRLI(vx1, JODY_HASH_SHIFT);
+		vx2  = JH_AVX2_SLLI(vx3, (JODY_HASH_WIDTH - JODY_HASH_SHIFT));
 		vx1  = _mm256_or_si256(vx1, vx2);
 		vx1  = _mm256_xor_si256(vx1, avx_ror2);  // XOR against the ROR2 constant
 
 		/* Add the constant to "element" */
-		vx3  = _mm256_add_epi64(vx3,  avx_const);
+		vx3  = JH_AVX2_ADD(vx3,  avx_const);
 
 		/* Perform the rest of the hash */
-		for (int j = 0; j < 4; j++) {
-			uint64_t ep1, ep2;
-			switch (j) {
-				default:
-				case 0:
-				ep1 = (uint64_t)_mm256_extract_epi64(vx3, 0);
-				ep2 = (uint64_t)_mm256_extract_epi64(vx1, 0);
-				break;
-				case 1:
-				ep1 = (uint64_t)_mm256_extract_epi64(vx3, 1);
-				ep2 = (uint64_t)_mm256_extract_epi64(vx1, 1);
-				break;
-				case 2:
-				ep1 = (uint64_t)_mm256_extract_epi64(vx3, 2);
-				ep2 = (uint64_t)_mm256_extract_epi64(vx1, 2);
-				break;
-				case 3:
-				ep1 = (uint64_t)_mm256_extract_epi64(vx3, 3);
-				ep2 = (uint64_t)_mm256_extract_epi64(vx1, 3);
-				break;
-			}
-			*hash += ep1;
-			*hash ^= ep2;
-			*hash = JH_ROL2(*hash);
-			*hash += ep1;
+		ep1.v256 = vx3;
+		ep2.v256 = vx1;
+		for (size_t j = 0; j < JH_VEC_LANES; j++) {
+			s0 = prev + ep1.vjh[j];
+			prev = ep1.vjh[j];
+			f0 = ep2.vjh[j];
+			JH_OPAQUE(s0);
+			JH_CHAIN_STEP(r, s0, f0);
 		}  // End of hash finish loop
 	}  // End of main AVX for loop
+	*hash = r + prev;
 	*data += vec_allocsize / sizeof(jodyhash_t);
-	if (((uintptr_t)*data & (uintptr_t)0x1fULL) != 0) ALIGNED_FREE(aligned_data);
 	*length = (count - vec_allocsize) / sizeof(jodyhash_t);
 	return 0;
 }
 
+/* jodyhash-wide: one hash step on a vector of lanes 'a' with data 'v' */
+#define JH_WIDE_STEP_AVX2(a, v) do { \
+	__m256i e_, f_; \
+	f_ = _mm256_or_si256(JH_AVX2_SRLI(v, JODY_HASH_SHIFT), JH_AVX2_SLLI(v, (JODY_HASH_WIDTH - JODY_HASH_SHIFT))); \
+	f_ = _mm256_xor_si256(f_, avx_ror2); \
+	e_ = JH_AVX2_ADD(v, avx_const); \
+	a = JH_AVX2_ADD(a, e_); \
+	a = _mm256_xor_si256(a, f_); \
+	a = _mm256_or_si256(JH_AVX2_SLLI(a, JH_SHIFT2), JH_AVX2_SRLI(a, (JODY_HASH_WIDTH - JH_SHIFT2))); \
+	a = JH_AVX2_ADD(a, e_); \
+} while (0)
+
+/* jodyhash-wide stripes: a 64-byte stripe is two vectors of lanes and
+ * the whole hash step runs on both of them side by side */
+void jody_block_hash_wide_avx2(const jodyhash_t *data, jodyhash_t *lanes, size_t stripes)
+{
+	const __m256i *vec_data = (const __m256i *)(const void *)data;
+	__m256i a0, a1, v0, v1;
+	__m256i avx_const, avx_ror2;
+	const size_t prefetch = JH_PREFETCH_FOR(stripes * JODY_HASH_WIDE_STRIPE);
+
+	avx_const = _mm256_load_si256(&vec_constant.v256);
+	avx_ror2  = _mm256_load_si256(&vec_constant_ror2.v256);
+
+	a0 = _mm256_loadu_si256((const __m256i *)(const void *)lanes);
+	a1 = _mm256_loadu_si256((const __m256i *)(const void *)lanes + 1);
+	for (; stripes > 0; stripes--) {
+		if (prefetch != 0) JH_PREFETCH_NTA((const char *)vec_data + prefetch);
+		v0 = _mm256_loadu_si256(&vec_data[0]);
+		v1 = _mm256_loadu_si256(&vec_data[1]);
+		JH_WIDE_STEP_AVX2(a0, v0);
+		JH_WIDE_STEP_AVX2(a1, v1);
+		vec_data += 2;
+	}
+	_mm256_storeu_si256((__m256i *)(void *)lanes, a0);
+	_mm256_storeu_si256((__m256i *)(void *)lanes + 1, a1);
+	return;
+}
+
+#if JODY_HASH_WIDTH == 64
+/* jodyhash128 over whole words
+ *
+ * The element work for both chains (ROR, XOR, add and the sums of
+ * neighbouring elements that the merged chains want, see
+ * jh_hash_words128_prefetch()) is done four words at a time in vectors.
+ * The chains themselves can't be vectorized, so they run in scalar
+ * registers like in jody_block_hash_avx2(). */
+void jody_block_hash128_avx2(const jodyhash_t *data, jodyhash128_t *hash, const size_t length)
+{
+	const __m256i *vec_data = (const __m256i *)(const void *)data;
+	const size_t vecs = length / JH_VEC_LANES;
+	const jodyhash_t diff = (jodyhash_t)(JODY_HASH128_CONSTANT - JODY_HASH_CONSTANT);
+	const __m256i ca = _mm256_set1_epi64x((long long)JODY_HASH_CONSTANT);
+	const __m256i diff2 = _mm256_set1_epi64x((long long)(2 * diff));
+	const __m256i ca_ror2 = _mm256_set1_epi64x((long long)JODY_HASH_CONSTANT_ROR2);
+	const __m256i cb_ror2 = _mm256_set1_epi64x((long long)JODY_HASH128_CONSTANT_ROR2);
+	__m256i w, e, q, p;
+	union UINT256 sa, sb, fa, fb;
+	jodyhash_t ra = hash->lo, rb = hash->hi - diff;
+	const size_t prefetch = JH_PREFETCH_FOR(length * sizeof(jodyhash_t));
+
+	/* Lane 0 of p is the last element of the previous vector */
+	p = _mm256_setzero_si256();
+
+	for (size_t i = 0; i < vecs; i++) {
+		if (prefetch != 0) JH_PREFETCH_NTA((const char *)&vec_data[i] + prefetch);
+		w = _mm256_loadu_si256(&vec_data[i]);
+		fa.v256 = _mm256_or_si256(_mm256_srli_epi64(w, JODY_HASH_SHIFT), _mm256_slli_epi64(w, 64 - JODY_HASH_SHIFT));
+		fa.v256 = _mm256_xor_si256(fa.v256, ca_ror2);
+		fb.v256 = _mm256_or_si256(_mm256_srli_epi64(w, JODY_HASH128_SHIFT), _mm256_slli_epi64(w, 64 - JODY_HASH128_SHIFT));
+		fb.v256 = _mm256_xor_si256(fb.v256, cb_ror2);
+		e = _mm256_add_epi64(w, ca);
+		/* s[j] = e[j - 1] + e[j] */
+		q = _mm256_permute4x64_epi64(e, _MM_SHUFFLE(2, 1, 0, 3));
+		sa.v256 = _mm256_add_epi64(e, _mm256_blend_epi32(q, p, 0x03));
+		sb.v256 = _mm256_add_epi64(sa.v256, diff2);
+		p = q;
+
+		for (size_t j = 0; j < JH_VEC_LANES; j++) {
+			JH_CHAIN_STEP(ra, sa.vjh[j], fa.vjh[j]);
+			JH128_CHAIN_STEP(rb, sb.vjh[j], fb.vjh[j]);
+		}
+	}
+	p = _mm256_permute4x64_epi64(p, 0);
+	hash->lo = ra + (jodyhash_t)_mm_cvtsi128_si64(_mm256_castsi256_si128(p));
+	hash->hi = rb + (jodyhash_t)_mm_cvtsi128_si64(_mm256_castsi256_si128(p)) + diff;
+
+	jh_hash_words128_prefetch(data + (vecs * JH_VEC_LANES), hash, length - (vecs * JH_VEC_LANES), 0);
+	return;
+}
+
+/* Hash groups of four independent keys, one per 64-bit lane
+ *
+ * Every lane runs its own textbook hash chain, so one vector step moves
+ * four keys forward by one word; the words are fetched with gathers.
+ * Lanes whose key is shorter than the longest one in the group stop
+ * being updated once they run out of words. The tail (count not
+ * divisible by 8) is loaded up front without reading past the key and
+ * is hashed as the last step of the lane, which adds element2 instead
+ * of element just like jody_block_hash() does. Key lengths are random,
+ * so all of this is done with masks instead of per-lane branches. */
+size_t jody_block_hash_multi_avx2(const void * const *bufs, const size_t *lens, jodyhash_t *out, const size_t n)
+{
+	__m256i vptr, vlen, vwords, vsteps, vtail, vh, vt, vw, ve, ve2, vi, lo, hi;
+	__m256i hasrem, m, active, tailstep;
+	__m256i avx_const, avx_ror2;
+	const __m256i zero = _mm256_setzero_si256(), ones = _mm256_set1_epi64x(-1);
+	const __m256i three = _mm256_set1_epi64x(3), four = _mm256_set1_epi64x(4);
+	const __m256i seven = _mm256_set1_epi64x(7), eight = _mm256_set1_epi64x(8);
+	const __m256i lanes = _mm256_setr_epi64x(0, 1, 2, 3);
+	/* Picks the low dword of each qword for the 32-bit gathers */
+	const __m256i narrow = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+	size_t k, maxlen;
+	int shortlanes;
+
+	avx_const = _mm256_load_si256(&vec_constant.v256);
+	avx_ror2  = _mm256_load_si256(&vec_constant_ror2.v256);
+
+	for (k = 0; k + 4 <= n; k += 4) {
+		vptr = _mm256_loadu_si256((const __m256i *)(const void *)(bufs + k));
+		vlen = _mm256_loadu_si256((const __m256i *)(const void *)(lens + k));
+		vwords = _mm256_srli_epi64(vlen, 3);
+		hasrem = _mm256_xor_si256(_mm256_cmpeq_epi64(_mm256_and_si256(vlen, seven), zero), ones);
+		vsteps = _mm256_sub_epi64(vwords, hasrem);
+		maxlen = lens[k];
+		if (lens[k + 1] > maxlen) maxlen = lens[k + 1];
+		if (lens[k + 2] > maxlen) maxlen = lens[k + 2];
+		if (lens[k + 3] > maxlen) maxlen = lens[k + 3];
+
+		/* Tails of keys with 8+ bytes: the last 8 bytes shifted into place */
+		m = _mm256_and_si256(hasrem, _mm256_cmpgt_epi64(vlen, seven));
+		vtail = _mm256_mask_i64gather_epi64(zero, NULL,
+				_mm256_sub_epi64(_mm256_add_epi64(vptr, vlen), eight), m, 1);
+		vtail = _mm256_srlv_epi64(vtail, _mm256_slli_epi64(_mm256_sub_epi64(eight, _mm256_and_si256(vlen, seven)), 3));
+		/* 4-7 byte keys: two overlapping 4 byte loads */
+		m = _mm256_andnot_si256(_mm256_cmpgt_epi64(vlen, seven), _mm256_cmpgt_epi64(vlen, three));
+		m = _mm256_permutevar8x32_epi32(m, narrow);
+		lo = _mm256_cvtepu32_epi64(_mm256_mask_i64gather_epi32(_mm_setzero_si128(), NULL,
+				vptr, _mm256_castsi256_si128(m), 1));
+		hi = _mm256_cvtepu32_epi64(_mm256_mask_i64gather_epi32(_mm_setzero_si128(), NULL,
+				_mm256_sub_epi64(_mm256_add_epi64(vptr, vlen), four), _mm256_castsi256_si128(m), 1));
+		hi = _mm256_sllv_epi64(hi, _mm256_slli_epi64(_mm256_sub_epi64(vlen, four), 3));
+		vtail = _mm256_or_si256(vtail, _mm256_or_si256(lo, hi));
+		/* 1-3 byte keys are rare enough to load one by one */
+		m = _mm256_and_si256(hasrem, _mm256_cmpgt_epi64(four, vlen));
+		shortlanes = _mm256_movemask_pd(_mm256_castsi256_pd(m));
+		for (; shortlanes != 0; shortlanes &= shortlanes - 1) {
+			const int l = __builtin_ctz((unsigned int)shortlanes);
+			vtail = _mm256_blendv_epi8(vtail,
+					_mm256_set1_epi64x((long long)jh_load_tail64((const unsigned char *)bufs[k + (size_t)l], lens[k + (size_t)l])),
+					_mm256_cmpeq_epi64(lanes, _mm256_set1_epi64x(l)));
+		}
+
+		vh = _mm256_loadu_si256((const __m256i *)(const void *)(out + k));
+		for (size_t i = 0; i < (maxlen + 7) / 8; i++) {
+			vi = _mm256_set1_epi64x((long long)i);
+			active   = _mm256_cmpgt_epi64(vsteps, vi);
+			tailstep = _mm256_cmpeq_epi64(vwords, vi);
+			/* Whole words come from the key, anything after that from the tail */
+			vw = _mm256_mask_i64gather_epi64(vtail, NULL,
+					_mm256_add_epi64(vptr, _mm256_slli_epi64(vi, 3)),
+					_mm256_cmpgt_epi64(vwords, vi), 1);
+
+			/* element2 = ROR(data) ^ ROR2(constant), element = data + constant */
+			ve2 = _mm256_or_si256(_mm256_srli_epi64(vw, JODY_HASH_SHIFT),
+					_mm256_slli_epi64(vw, 64 - JODY_HASH_SHIFT));
+			ve2 = _mm256_xor_si256(ve2, avx_ror2);
+			ve  = _mm256_add_epi64(vw, avx_const);
+
+			vt = _mm256_add_epi64(vh, ve);
+			vt = _mm256_xor_si256(vt, ve2);
+			vt = _mm256_or_si256(_mm256_slli_epi64(vt, JH_SHIFT2),
+					_mm256_srli_epi64(vt, 64 - JH_SHIFT2));
+			vt = _mm256_add_epi64(vt, _mm256_blendv_epi8(ve, ve2, tailstep));
+			vh = _mm256_blendv_epi8(vh, vt, active);
+		}
+		_mm256_storeu_si256((__m256i *)(void *)(out + k), vh);
+	}
+	return k;
+}
+#endif /* JODY_HASH_WIDTH == 64 */
+
 #endif /* NO_AVX2 */
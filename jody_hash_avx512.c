@@ -0,0 +1,198 @@
+/* Jody Bruchon's fast hashing function
+ *
+ * This function was written to generate a fast hash that also has a
+ * fairly low collision rate. The collision rate is much higher than
+ * a secure hash algorithm, but the calculation is drastically simpler
+ * and faster.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jody_hash.h"
+#include "jody_hash_simd.h"
+
+#ifndef NO_AVX512
+
+/* GCC's _mm512_undefined_epi32() (used inside most AVX-512 intrinsics)
+ * initializes a variable with itself, which sets off -Wuninitialized */
+#if defined __GNUC__ && !defined __clang__
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+int jody_block_hash_avx512(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length)
+{
+	size_t vec_allocsize;
+	const __m512i *vec_data;
+	/* vz1 = ROR/XOR work ("element2"), vz3 = data+constant ("element") */
+	__m512i vz1, vz3;
+	__m512i avx512_const, avx512_ror2;
+	uint64_t ep1[8], ep2[8];
+	/* Chain state in merged form, see jh_hash_words() */
+	jodyhash_t r = *hash, prev = 0;
+	jodyhash_t s0, f0;
+	const size_t prefetch = JH_PREFETCH_FOR(count);
+
+	/* Constants preload (broadcast the 256-bit constants to both halves) */
+	avx512_const = _mm512_broadcast_i64x4(_mm256_load_si256(&vec_constant.v256));
+	avx512_ror2  = _mm512_broadcast_i64x4(_mm256_load_si256(&vec_constant_ror2.v256));
+
+	/* Data is read in place with unaligned loads (see the SSE2 version) */
+	vec_allocsize = count & 0xffffffffffffffc0U;
+	vec_data = (const __m512i *)*data;
+
+	for (size_t i = 0; i < (vec_allocsize / 64); i++) {
+		if (prefetch != 0) JH_PREFETCH_NTA((const char *)&vec_data[i] + prefetch);
+		vz3  = _mm512_loadu_si512(&vec_data[i]);
+
+		/* "element2" gets RORed with a native 64-bit rotate (vprorq) */
+		vz1  = _mm512_ror_epi64(vz3, JODY_HASH_SHIFT);
+		vz1  = _mm512_xor_si512(vz1, avx512_ror2);  // XOR against the ROR2 constant
+
+		/* Add the constant to "element" */
+		vz3  = _mm512_add_epi64(vz3, avx512_const);
+
+		/* Perform the rest of the hash */
+		_mm512_storeu_si512(ep1, vz3);
+		_mm512_storeu_si512(ep2, vz1);
+		for (int j = 0; j < 8; j++) {
+			s0 = prev + ep1[j];
+			prev = ep1[j];
+			f0 = ep2[j];
+			JH_OPAQUE(s0);
+			JH_CHAIN_STEP(r, s0, f0);
+		}  // End of hash finish loop
+	}  // End of main AVX-512 for loop
+	*hash = r + prev;
+	*data += vec_allocsize / sizeof(jodyhash_t);
+	*length = (count - vec_allocsize) / sizeof(jodyhash_t);
+	return 0;
+}
+
+/* Hash groups of eight independent keys, one per 64-bit lane
+ * This is jody_block_hash_multi_avx2() with mask registers and native
+ * rotates; see there for how ragged lengths and tails are handled */
+size_t jody_block_hash_multi_avx512(const void * const *bufs, const size_t *lens, jodyhash_t *out, const size_t n)
+{
+	__m512i vptr, vlen, vwords, vsteps, vtail, vh, vt, vw, ve, ve2, vi, lo, hi;
+	__m512i avx512_const, avx512_ror2;
+	const __m512i zero = _mm512_setzero_si512();
+	const __m512i four = _mm512_set1_epi64(4), seven = _mm512_set1_epi64(7), eight = _mm512_set1_epi64(8);
+	__mmask8 hasrem, m, active, tailstep;
+	size_t k, maxsteps;
+
+	avx512_const = _mm512_broadcast_i64x4(_mm256_load_si256(&vec_constant.v256));
+	avx512_ror2  = _mm512_broadcast_i64x4(_mm256_load_si256(&vec_constant_ror2.v256));
+
+	for (k = 0; k + 8 <= n; k += 8) {
+		vptr = _mm512_loadu_si512(bufs + k);
+		vlen = _mm512_loadu_si512(lens + k);
+		vwords = _mm512_srli_epi64(vlen, 3);
+		hasrem = _mm512_test_epi64_mask(vlen, seven);
+		vsteps = _mm512_mask_add_epi64(vwords, hasrem, vwords, _mm512_set1_epi64(1));
+		maxsteps = (size_t)((_mm512_reduce_max_epu64(vlen) + 7) / 8);
+
+		/* Tails of keys with 8+ bytes: the last 8 bytes shifted into place */
+		m = _mm512_mask_cmpge_epu64_mask(hasrem, vlen, eight);
+		vtail = _mm512_mask_i64gather_epi64(zero, m, _mm512_sub_epi64(_mm512_add_epi64(vptr, vlen), eight), NULL, 1);
+		vtail = _mm512_srlv_epi64(vtail, _mm512_slli_epi64(_mm512_sub_epi64(eight, _mm512_and_si512(vlen, seven)), 3));
+		/* 4-7 byte keys: two overlapping 4 byte loads */
+		m = _mm512_mask_cmpge_epu64_mask(_mm512_cmplt_epu64_mask(vlen, eight), vlen, four);
+		lo = _mm512_cvtepu32_epi64(_mm512_mask_i64gather_epi32(_mm256_setzero_si256(), m, vptr, NULL, 1));
+		hi = _mm512_cvtepu32_epi64(_mm512_mask_i64gather_epi32(_mm256_setzero_si256(), m,
+				_mm512_sub_epi64(_mm512_add_epi64(vptr, vlen), four), NULL, 1));
+		hi = _mm512_sllv_epi64(hi, _mm512_slli_epi64(_mm512_sub_epi64(vlen, four), 3));
+		vtail = _mm512_or_si512(vtail, _mm512_or_si512(lo, hi));
+		/* 1-3 byte keys are rare enough to load one by one */
+		m = _mm512_mask_cmplt_epu64_mask(hasrem, vlen, four);
+		for (; m != 0; m &= (__mmask8)(m - 1)) {
+			const size_t l = (size_t)__builtin_ctz(m);
+			vtail = _mm512_mask_set1_epi64(vtail, (__mmask8)(1U << l),
+					(long long)jh_load_tail64((const unsigned char *)bufs[k + l], lens[k + l]));
+		}
+
+		vh = _mm512_loadu_si512(out + k);
+		for (size_t i = 0; i < maxsteps; i++) {
+			vi = _mm512_set1_epi64((long long)i);
+			active   = _mm512_cmpgt_epu64_mask(vsteps, vi);
+			tailstep = _mm512_cmpeq_epu64_mask(vwords, vi);
+			/* Whole words come from the key, anything after that from the tail */
+			vw = _mm512_mask_i64gather_epi64(vtail, _mm512_cmpgt_epu64_mask(vwords, vi),
+					_mm512_add_epi64(vptr, _mm512_slli_epi64(vi, 3)), NULL, 1);
+
+			ve2 = _mm512_xor_si512(_mm512_ror_epi64(vw, JODY_HASH_SHIFT), avx512_ror2);
+			ve  = _mm512_add_epi64(vw, avx512_const);
+
+			vt = _mm512_add_epi64(vh, ve);
+			vt = _mm512_xor_si512(vt, ve2);
+			vt = _mm512_rol_epi64(vt, JH_SHIFT2);
+			vt = _mm512_add_epi64(vt, _mm512_mask_blend_epi64(tailstep, ve, ve2));
+			vh = _mm512_mask_blend_epi64(active, vh, vt);
+		}
+		_mm512_storeu_si512(out + k, vh);
+	}
+	return k;
+}
+
+
+/* Gear table entries for 16 bytes (see jh_cdc_gear[]) */
+static inline __m512i jh_cdc_gear16(const unsigned char *p)
+{
+	__m512i x = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i *)p));
+
+	x = _mm512_add_epi32(x, _mm512_set1_epi32((int)JH_CDC_GEAR_SEED));
+	x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 16));
+	x = _mm512_mullo_epi32(x, _mm512_set1_epi32((int)JH_CDC_FMIX_M1));
+	x = _mm512_xor_si512(x, _mm512_srli_epi32(x, 13));
+	x = _mm512_mullo_epi32(x, _mm512_set1_epi32((int)JH_CDC_FMIX_M2));
+	return _mm512_xor_si512(x, _mm512_srli_epi32(x, 16));
+}
+
+/* Chunk boundary scan, 16 positions at a time (see jh_cdc_scan())
+ *
+ * The Gear hash at each position is a sum of the shifted gear values of
+ * the 32 bytes up to it, which is a prefix sum: adding in the value of
+ * the position 1, 2, 4 and 8 back (shifted by as much) gives the sum of
+ * the last 16, and the sum 16 positions back shifted by 16 completes it.
+ * valignd brings in the lanes that come from the previous 16 positions,
+ * so each step keeps its input from the previous round. The gear values
+ * are computed rather than gathered, which is slow on a lot of CPUs. */
+size_t jody_cdc_scan_avx512(const unsigned char *data, size_t i, const size_t mid,
+		const size_t end, const uint32_t mask_s, const uint32_t mask_l)
+{
+	__m512i x, t, p1, p2, p4, p8, p16;
+	const __m512i vmask_s = _mm512_set1_epi32((int)mask_s), vmask_l = _mm512_set1_epi32((int)mask_l);
+	__mmask16 valid, small, hits;
+	size_t pos;
+
+	p1 = p2 = p4 = p8 = p16 = _mm512_setzero_si512();
+	/* The first round only fills in the window before data[i] */
+	for (pos = i - (JODY_CDC_WINDOW - 1); pos + 16 <= end; pos += 16) {
+		x = jh_cdc_gear16(data + pos);
+		t = _mm512_alignr_epi32(x, p1, 15); p1 = x;
+		x = _mm512_add_epi32(x, _mm512_slli_epi32(t, 1));
+		t = _mm512_alignr_epi32(x, p2, 14); p2 = x;
+		x = _mm512_add_epi32(x, _mm512_slli_epi32(t, 2));
+		t = _mm512_alignr_epi32(x, p4, 12); p4 = x;
+		x = _mm512_add_epi32(x, _mm512_slli_epi32(t, 4));
+		t = _mm512_alignr_epi32(x, p8, 8); p8 = x;
+		x = _mm512_add_epi32(x, _mm512_slli_epi32(t, 8));
+		t = p16; p16 = x;
+		x = _mm512_add_epi32(x, _mm512_slli_epi32(t, 16));
+		if (pos + 16 <= i) continue;
+
+		valid = (pos >= i) ? 0xffff : (__mmask16)(0xffffU << (i - pos));
+		if (pos + 16 <= mid) small = 0xffff;
+		else small = (pos >= mid) ? 0 : (__mmask16)((1U << (mid - pos)) - 1);
+		hits = _mm512_mask_testn_epi32_mask((__mmask16)(valid & small), x, vmask_s)
+			| _mm512_mask_testn_epi32_mask((__mmask16)(valid & ~small), x, vmask_l);
+		if (hits != 0) return pos + (size_t)__builtin_ctz(hits);
+	}
+	return jh_cdc_scan(data, (pos > i) ? pos : i, mid, end, mask_s, mask_l);
+}
+
+#endif /* NO_AVX512 */
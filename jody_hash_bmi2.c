@@ -0,0 +1,34 @@
+/* Jody Bruchon's fast hashing function
+ *
+ * This function was written to generate a fast hash that also has a
+ * fairly low collision rate. The collision rate is much higher than
+ * a secure hash algorithm, but the calculation is drastically simpler
+ * and faster.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jody_hash.h"
+#include "jody_hash_simd.h"
+
+#ifndef NO_BMI2
+
+/* Scalar kernel for CPUs with BMI2. This is the generic pipelined loop
+ * built with -mbmi2 so every rotate becomes a non-destructive rorx; that
+ * saves the register copy in front of each off-chain ROR, which matters
+ * on CPUs where move elimination is missing or disabled. */
+int jody_block_hash_bmi2(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length)
+{
+	const size_t words = count / sizeof(jodyhash_t);
+
+	jh_hash_words_prefetch(*data, hash, words, JH_PREFETCH_FOR(count));
+	*data += words;
+	*length = 0;
+	return 0;
+}
+
+#endif /* NO_BMI2 */
@@ -0,0 +1,152 @@
+/* Jody Bruchon's fast hashing function: content-defined chunking
+ *
+ * Chunk boundaries are where a Gear rolling hash of the last
+ * JODY_CDC_WINDOW bytes has all of the bits of a mask clear. The mask
+ * has more bits before the average chunk size and fewer after it
+ * (FastCDC's normalized chunking), and nothing is looked at before the
+ * minimum size, which is where most of the speed comes from. Every chunk
+ * gets a jody_block_hash() fingerprint. See jody_hash.h for the rules.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "jody_hash.h"
+#include "jody_hash_simd.h"
+
+#define JH_CDC_DEFAULT_AVG 8192
+
+/* fmix32(byte + JH_CDC_GEAR_SEED) for every byte (see jody_hash_simd.h) */
+const uint32_t jh_cdc_gear[256] = {
+	0xcd93c1cfU, 0x0694cc0cU, 0xaaeeda57U, 0xa68d5ea9U,
+	0xac250758U, 0x507f01e1U, 0xab65b0b3U, 0x62525927U,
+	0xf50debb1U, 0x1f5106e9U, 0x4cd474bdU, 0xd1c06f2dU,
+	0x6c054789U, 0xef2cf46cU, 0xd6091930U, 0x97802f56U,
+	0xc9a1053fU, 0xa0324e83U, 0x1a691769U, 0xab18e795U,
+	0x9031a45dU, 0x17a42f6bU, 0x25370c3eU, 0xeb4f6679U,
+	0xfe311cf2U, 0x2e62f233U, 0xa8178927U, 0x07b3c5d5U,
+	0x86a4411aU, 0x31da16fbU, 0x04d682deU, 0x9ce47d10U,
+	0x2eb9447cU, 0x0c819dffU, 0x04c91d12U, 0x122005b8U,
+	0x95312750U, 0x06ffa6a5U, 0xf0cf6185U, 0x809ba1daU,
+	0x6f92422aU, 0xd94d8871U, 0xbeae610bU, 0x2c3f1f2eU,
+	0x502bdb0bU, 0xcd05f2a9U, 0x27906f8dU, 0x0caef67cU,
+	0xa34f1d35U, 0x6a547c81U, 0x6235b369U, 0x85045475U,
+	0x372b1fbbU, 0x04151819U, 0x223f7242U, 0xff3b8a29U,
+	0x213db957U, 0xf902f167U, 0x7193c28fU, 0x4a7af630U,
+	0x6a0b9539U, 0x00edccb0U, 0xdbe401a8U, 0xf12dccfdU,
+	0x482950b8U, 0xdc6983ebU, 0x6aed442fU, 0xd1bbd281U,
+	0x61f17596U, 0xaeb6818bU, 0xb38f6263U, 0xd77aa1c9U,
+	0xd4899878U, 0xcdd214f0U, 0x9d9ffd08U, 0x5d56aeeeU,
+	0x83687ba9U, 0x7a01beabU, 0x7ba8f467U, 0xb6106131U,
+	0x1e419119U, 0xb510a28bU, 0x6fd60163U, 0x21e91e3aU,
+	0x838590a4U, 0x2e2a89b0U, 0xd3b537aaU, 0x144393c2U,
+	0x05b257caU, 0xd740ec7bU, 0x310c9869U, 0x9b533de2U,
+	0xf5ac30acU, 0x92b5a9beU, 0x593dc200U, 0x1c39b68bU,
+	0xeb152f3aU, 0x7867bb12U, 0x61d92fe5U, 0xbe22f38dU,
+	0xd47cacceU, 0x40f9aee7U, 0xc6ebb7e0U, 0x3b8f528fU,
+	0xb47c2ccdU, 0x081fc088U, 0x8ab8da1aU, 0x6d7d6205U,
+	0xb1d50099U, 0xe2b7bea8U, 0x1385409fU, 0x91ffbfa9U,
+	0xaf33f060U, 0x7a58ace4U, 0x6855d995U, 0xa0b68a6eU,
+	0x3f804ea1U, 0xee2c9263U, 0xb36a3140U, 0x418faaceU,
+	0x54d9f7daU, 0x13a706bbU, 0x45c3bf26U, 0xa85b122aU,
+	0x03c54cf6U, 0xd9d87f34U, 0xe3da1e67U, 0x32f5ce92U,
+	0xdc8a8bb0U, 0xc621ed94U, 0x1681621aU, 0x2ab670a7U,
+	0xb19303d0U, 0x8b2abc66U, 0xd1e32fbeU, 0x2c029f65U,
+	0x51fef934U, 0xc5716bd4U, 0x85930fc8U, 0xbcfc3463U,
+	0x284b6559U, 0xd7df69a2U, 0xe136251dU, 0x23597249U,
+	0x698feb7eU, 0x18ba7fcdU, 0x57ac102eU, 0x6c38bfc2U,
+	0x9f243e76U, 0xb56a8ff7U, 0xb9fa44d6U, 0x70fd48ddU,
+	0x39f49f65U, 0xbbe56a07U, 0x67d41436U, 0xf04ecb76U,
+	0x8048ce89U, 0x66a0035fU, 0x1f455d1fU, 0xac980879U,
+	0x2a722b01U, 0xe0b2ce6eU, 0x922bb6feU, 0xd0176d20U,
+	0x5ac7f2adU, 0xb3899eacU, 0x3fc68295U, 0x3efb65c3U,
+	0xfccb7dd2U, 0x78d3ab8cU, 0xf020c3faU, 0x6a45cbf5U,
+	0xbdb3999aU, 0x623c844bU, 0xd119f44bU, 0x77555a9cU,
+	0x4993b4b8U, 0xb0cfeabbU, 0xe86b29d6U, 0x844e768eU,
+	0x400f5096U, 0x2d88315fU, 0xe887cd35U, 0x42cfb476U,
+	0x5f60d56bU, 0x49a64da2U, 0xa6f96b84U, 0x60c34f2aU,
+	0x20312a0aU, 0xbac31467U, 0x37b8490dU, 0xd3c405abU,
+	0xfb56c5a4U, 0x62a601ebU, 0x8c44c667U, 0x6133daeaU,
+	0xa9f4123cU, 0xae576c63U, 0xc5f41e51U, 0x1e7bfed1U,
+	0xc6a1b3f3U, 0x56d57838U, 0x2db46280U, 0xd6efeeb8U,
+	0x249c6ee6U, 0xfe6dad18U, 0x50321f36U, 0x11215139U,
+	0x86b8bdd1U, 0x9e2de017U, 0xd76c5186U, 0xf7f70435U,
+	0x508a3f00U, 0xdc08c86dU, 0x1daf71fbU, 0x6da737dfU,
+	0x11cb7c12U, 0x6b85d70fU, 0x7f26cfbcU, 0x9a638893U,
+	0x9a6a0b63U, 0xd1bfb4bdU, 0xad9a52e8U, 0xdbd0e979U,
+	0x668f441fU, 0xfe8ef19aU, 0xbb3c5ca1U, 0xbb47dd09U,
+	0xb920c99bU, 0x651d0bf4U, 0x261df0edU, 0xb4aaac35U,
+	0x27213833U, 0x10264210U, 0xe76ba738U, 0x93f6e7e1U,
+	0xfe96bd93U, 0x8d50a736U, 0x24de34fdU, 0x526c5321U,
+	0xf1877233U, 0x30dd9bf2U, 0xbe4c6f8dU, 0x0b8efbf9U,
+	0xa25089daU, 0x0879293fU, 0x6f37ac04U, 0x6eb52f8dU,
+	0x41dd2eb9U, 0x829a46a5U, 0x216e8e74U, 0xb7d5c825U,
+	0x98ba262eU, 0xaf56d3e1U, 0xd24002b2U, 0x96f859a6U,
+};
+
+
+extern int jody_cdc_init(jody_cdc_t *cdc, size_t min_size, size_t avg_size, size_t max_size)
+{
+	unsigned int bits = 0;
+
+	if (avg_size == 0) avg_size = JH_CDC_DEFAULT_AVG;
+	if (min_size == 0) min_size = avg_size / 4;
+	if (max_size == 0) max_size = avg_size * 8;
+	if (min_size < JODY_CDC_MIN_SIZE || min_size >= avg_size || avg_size > max_size) return 1;
+	/* Masks of log2(avg_size) +/- 2 bits; the top bits of the hash are
+	 * the ones that depend on the whole window */
+	while ((avg_size >> (bits + 1)) != 0) bits++;
+	if (bits + 2 > 32) return 1;
+	cdc->min_size = min_size;
+	cdc->avg_size = avg_size;
+	cdc->max_size = max_size;
+	cdc->mask_s = ~0U << (32 - (bits + 2));
+	cdc->mask_l = ~0U << (32 - (bits - 2));
+	return 0;
+}
+
+
+/* Chunk length at the start of p, or 0 if there's not enough data */
+static size_t jh_cdc_cut(const jody_cdc_t *cdc, const unsigned char *p, const size_t count,
+		const int final, const jh_cdc_kernel_t kernel)
+{
+	size_t end, cut;
+
+	if (count <= cdc->min_size) return final ? count : 0;
+	end = (count < cdc->max_size) ? count : cdc->max_size;
+	/* Position i ends a chunk of i + 1 bytes */
+	if (kernel != NULL) cut = kernel(p, cdc->min_size - 1, cdc->avg_size - 1, end, cdc->mask_s, cdc->mask_l);
+	else cut = jh_cdc_scan(p, cdc->min_size - 1, cdc->avg_size - 1, end, cdc->mask_s, cdc->mask_l);
+	if (cut < end) return cut + 1;
+	if (end == cdc->max_size || final) return end;
+	return 0;
+}
+
+extern size_t jody_cdc_next(const jody_cdc_t *cdc, const void *data, const size_t count, const int final)
+{
+	return jh_cdc_cut(cdc, (const unsigned char *)data, count, final, jh_cdc_kernel());
+}
+
+
+extern size_t jody_cdc_chunks(const jody_cdc_t *cdc, const void *data, const size_t count, const int final,
+		jody_chunk_t *chunks, const size_t max_chunks, size_t *used)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const jh_cdc_kernel_t kernel = jh_cdc_kernel();
+	size_t n = 0, offset = 0, len;
+
+	while (n < max_chunks && offset < count) {
+		len = jh_cdc_cut(cdc, p + offset, count - offset, final, kernel);
+		if (len == 0) break;
+		chunks[n].offset = offset;
+		chunks[n].length = len;
+		chunks[n].hash = 0;
+		jody_block_hash((jodyhash_t *)(uintptr_t)(p + offset), &chunks[n].hash, len);
+		offset += len;
+		n++;
+	}
+	*used = offset;
+	return n;
+}
@@ -0,0 +1,213 @@
+/* Jody Bruchon's fast hashing function: rsync-style deltas
+ *
+ * The old data is described by a signature: a weak rolling sum and a
+ * jodyhash for each block. The weak sums go in an open addressing hash
+ * table; the matcher slides a window of one block over the new data a
+ * byte at a time, updates the weak sum in constant time, and only
+ * hashes the window with jodyhash when the table has that weak sum.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "jody_hash.h"
+
+/* A table slot: the weak sum and block number + 1 (0 is an empty slot) */
+struct jh_delta_slot {
+	uint32_t weak;
+	uint32_t block;
+};
+
+/* Weak sums are poor in their low bits, so they are mixed to pick a slot */
+#define JH_DELTA_MIX(weak) ((size_t)(((weak) * 0x9e3779b1U) >> 7))
+#define JH_DELTA_SLOT(weak, mask) (JH_DELTA_MIX(weak) & (mask))
+
+/* Most windows match nothing, so a filter with four bits per slot (in
+ * the cache, where the table often isn't) says if a weak sum can be in
+ * the table at all before the table is looked at */
+#define JH_DELTA_BIT(weak, mask) ((size_t)(((weak) * 0x85ebca6bU) ^ ((weak) >> 15)) & (((mask) << 2) | 3))
+#define JH_DELTA_TEST(filter, bit) (((filter)[(bit) >> 6] >> ((bit) & 63)) & 1)
+
+/* rsync's rolling checksum: the sum of the bytes and the sum of those
+ * sums, 16 bits of each */
+#define JH_WEAK(a, b) (((a) & 0xffffU) | ((b) << 16))
+
+static void jh_weak_sums(const unsigned char *p, const size_t count, uint32_t *a, uint32_t *b)
+{
+	uint32_t s1 = 0, s2 = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		s1 += p[i];
+		s2 += s1;
+	}
+	*a = s1;
+	*b = s2;
+	return;
+}
+
+extern uint32_t jody_weak_sum(const void *data, const size_t count)
+{
+	uint32_t a, b;
+
+	jh_weak_sums((const unsigned char *)data, count, &a, &b);
+	return JH_WEAK(a, b);
+}
+
+
+extern int jody_block_signature(const void *data, const size_t count, const size_t blocksize, jody_block_sig_t *sigs)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	size_t len;
+
+	if (blocksize == 0) return 1;
+	for (size_t off = 0, i = 0; off < count; off += len, i++) {
+		len = (count - off < blocksize) ? count - off : blocksize;
+		sigs[i].weak = jody_weak_sum(p + off, len);
+		sigs[i].strong = 0;
+		if (jody_block_hash((jodyhash_t *)(uintptr_t)(p + off), &sigs[i].strong, len) != 0) return 1;
+	}
+	return 0;
+}
+
+
+/* Only whole blocks are put in the table: a short last block can't be
+ * found with a window of a whole block, so it is only looked for at the
+ * end of the new data */
+extern int jody_delta_index(jody_delta_index_t *index, const jody_block_sig_t *sigs, const size_t nblocks,
+		const size_t blocksize, const uint64_t size)
+{
+	const size_t whole = (size_t)(size / blocksize);
+	struct jh_delta_slot *slots;
+	uint64_t *filter;
+	size_t room = 16, slot, bit;
+
+	index->slots = NULL;
+	index->filter = NULL;
+	if (blocksize == 0 || nblocks != JODY_DELTA_BLOCKS(size, blocksize) || nblocks >= UINT32_MAX) return 1;
+	/* No more than half full keeps the probe sequences short */
+	while (room < whole * 2) room *= 2;
+	slots = (struct jh_delta_slot *)calloc(room, sizeof(struct jh_delta_slot));
+	filter = (uint64_t *)calloc(room / 16, sizeof(uint64_t));
+	if (slots == NULL || filter == NULL) {
+		free(slots);
+		free(filter);
+		return 1;
+	}
+	for (size_t i = 0; i < whole; i++) {
+		for (slot = JH_DELTA_SLOT(sigs[i].weak, room - 1); slots[slot].block != 0; slot = (slot + 1) & (room - 1)) {
+			/* Blocks that are the same as an earlier one are left out */
+			if (slots[slot].weak == sigs[i].weak && sigs[slots[slot].block - 1].strong == sigs[i].strong) break;
+		}
+		if (slots[slot].block != 0) continue;
+		slots[slot].weak = sigs[i].weak;
+		slots[slot].block = (uint32_t)(i + 1);
+		bit = JH_DELTA_BIT(sigs[i].weak, room - 1);
+		filter[bit >> 6] |= (uint64_t)1 << (bit & 63);
+	}
+	index->sigs = sigs;
+	index->nblocks = whole;
+	index->blocksize = blocksize;
+	index->tail = (size_t)(size % blocksize);
+	index->slots = slots;
+	index->filter = filter;
+	index->mask = room - 1;
+	return 0;
+}
+
+extern void jody_delta_index_free(jody_delta_index_t *index)
+{
+	free(index->slots);
+	free(index->filter);
+	index->slots = NULL;
+	index->filter = NULL;
+	return;
+}
+
+
+/* The old block that the window at p is a copy of, or JODY_DELTA_LITERAL;
+ * the block after the last match is tried first, since changes tend to
+ * leave long runs of blocks in their old order */
+static size_t jh_delta_find(const jody_delta_index_t *index, const unsigned char *p, const uint32_t weak, const size_t expect)
+{
+	const struct jh_delta_slot *slots = index->slots;
+	jodyhash_t strong = 0;
+	int hashed = 0;
+	size_t block;
+
+	/* The window is only hashed once a weak sum matches */
+	if (expect < index->nblocks && index->sigs[expect].weak == weak) {
+		jody_block_hash((jodyhash_t *)(uintptr_t)p, &strong, index->blocksize);
+		hashed = 1;
+		if (index->sigs[expect].strong == strong) return expect;
+	}
+	for (size_t slot = JH_DELTA_SLOT(weak, index->mask); slots[slot].block != 0; slot = (slot + 1) & index->mask) {
+		if (slots[slot].weak != weak) continue;
+		if (!hashed) {
+			jody_block_hash((jodyhash_t *)(uintptr_t)p, &strong, index->blocksize);
+			hashed = 1;
+		}
+		block = slots[slot].block - 1;
+		if (index->sigs[block].strong == strong) return block;
+	}
+	return JODY_DELTA_LITERAL;
+}
+
+extern int jody_delta(const jody_delta_index_t *index, const void *data, const size_t count, const int final,
+		const jody_delta_emit_t emit, void *arg, size_t *used)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	const size_t bs = index->blocksize, nblocks = index->nblocks, mask = index->mask;
+	const jody_block_sig_t *sigs = index->sigs;
+	const uint64_t *filter = index->filter;
+	size_t pos = 0, literal = 0, expect = 0, block, bit;
+	uint32_t a = 0, b = 0, weak;
+	int summed = 0;
+
+	while (pos + bs <= count) {
+		if (!summed) {
+			jh_weak_sums(p + pos, bs, &a, &b);
+			summed = 1;
+		}
+		/* The sliding loop only looks at the filter; the table is for
+		 * the few windows that get past it */
+		weak = JH_WEAK(a, b);
+		bit = JH_DELTA_BIT(weak, mask);
+		if (JH_DELTA_TEST(filter, bit) || (expect < nblocks && sigs[expect].weak == weak)) {
+			block = jh_delta_find(index, p + pos, weak, expect);
+			if (block != JODY_DELTA_LITERAL) {
+				if (literal < pos && emit(arg, literal, pos - literal, JODY_DELTA_LITERAL) != 0) return 1;
+				if (emit(arg, pos, bs, block) != 0) return 1;
+				pos += bs;
+				literal = pos;
+				expect = block + 1;
+				summed = 0;
+				continue;
+			}
+		}
+		/* Slide the window a byte */
+		if (pos + bs < count) {
+			a += (uint32_t)p[pos + bs] - p[pos];
+			b += a - (uint32_t)bs * p[pos];
+		}
+		pos++;
+	}
+	/* Without 'final' the bytes from pos on could still start a match */
+	if (final) {
+		const size_t tail = index->tail;
+		jodyhash_t strong = 0;
+
+		pos = count;
+		if (tail != 0 && count - literal >= tail && sigs[nblocks].weak == jody_weak_sum(p + count - tail, tail)
+				&& jody_block_hash((jodyhash_t *)(uintptr_t)(p + count - tail), &strong, tail) == 0
+				&& sigs[nblocks].strong == strong) {
+			if (literal < count - tail && emit(arg, literal, count - tail - literal, JODY_DELTA_LITERAL) != 0) return 1;
+			if (emit(arg, count - tail, tail, nblocks) != 0) return 1;
+			literal = count;
+		}
+	}
+	if (literal < pos && emit(arg, literal, pos - literal, JODY_DELTA_LITERAL) != 0) return 1;
+	*used = pos;
+	return 0;
+}
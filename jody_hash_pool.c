@@ -0,0 +1,167 @@
+/* Jody Bruchon's fast hashing function: thread pool
+ *
+ * A fixed set of worker threads that take turns with the caller at the
+ * indices of one job at a time. Jobs are things like tree hash leaves,
+ * which are all about the same size, so each thread just claims the next
+ * index until there are none left.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#ifndef NO_THREADS
+ #include <pthread.h>
+#endif
+#include "jody_hash_pool.h"
+
+/* More than this many threads never helps hashing */
+#define JH_POOL_MAX 256
+
+/* Worked out on first use; callers on several threads may all get there
+ * at once, so the cache is atomic (any of their answers will do) */
+extern unsigned int jh_pool_threads(void)
+{
+	static unsigned int threads = 0;
+	unsigned int cached;
+	const char *env;
+	long n = 1;
+
+	cached = __atomic_load_n(&threads, __ATOMIC_RELAXED);
+	if (cached > 0) return cached;
+	env = getenv("JODY_HASH_THREADS");
+	if (env != NULL) n = strtol(env, NULL, 10);
+#ifdef _SC_NPROCESSORS_ONLN
+	else n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (n < 1) n = 1;
+	if (n > JH_POOL_MAX) n = JH_POOL_MAX;
+	__atomic_store_n(&threads, (unsigned int)n, __ATOMIC_RELAXED);
+	return (unsigned int)n;
+}
+
+
+#ifdef NO_THREADS
+extern void jh_parallel_for(const size_t n, unsigned int threads, const jh_task_t task, void *arg)
+{
+	(void)threads;
+	for (size_t i = 0; i < n; i++) task(arg, i);
+	return;
+}
+
+#else
+
+/* The job being worked on; 'slots' is how many more workers may join it
+ * and 'busy' how many are still at it. Everything but 'next' is only
+ * touched with jh_pool_lock held. */
+static struct {
+	jh_task_t task;
+	void *arg;
+	size_t n;
+	size_t next;
+	unsigned int slots;
+	unsigned int busy;
+	unsigned long generation;
+} jh_job;
+
+static pthread_mutex_t jh_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jh_pool_wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t jh_pool_done = PTHREAD_COND_INITIALIZER;
+/* Only one job at a time */
+static pthread_mutex_t jh_pool_job_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int jh_pool_workers = 0;
+/* Set in the workers and in a caller while its job runs. A task that
+ * starts another job (a tree hash from inside a task, say) would wait
+ * forever for jh_pool_job_lock, so nested jobs run in the calling thread */
+static _Thread_local int jh_pool_inside = 0;
+
+/* Claim and run indices until there are none left */
+static void jh_pool_run(const jh_task_t task, void *arg, const size_t n)
+{
+	size_t i;
+
+	while ((i = __atomic_fetch_add(&jh_job.next, 1, __ATOMIC_RELAXED)) < n) task(arg, i);
+	return;
+}
+
+static void *jh_pool_worker(void *unused)
+{
+	unsigned long seen = 0;
+	jh_task_t task;
+	void *arg;
+	size_t n;
+
+	(void)unused;
+	jh_pool_inside = 1;
+	pthread_mutex_lock(&jh_pool_lock);
+	for (;;) {
+		while (jh_job.generation == seen || jh_job.slots == 0)
+			pthread_cond_wait(&jh_pool_wake, &jh_pool_lock);
+		seen = jh_job.generation;
+		jh_job.slots--;
+		jh_job.busy++;
+		task = jh_job.task;
+		arg = jh_job.arg;
+		n = jh_job.n;
+		pthread_mutex_unlock(&jh_pool_lock);
+
+		jh_pool_run(task, arg, n);
+
+		pthread_mutex_lock(&jh_pool_lock);
+		if (--jh_job.busy == 0) pthread_cond_signal(&jh_pool_done);
+	}
+	return NULL;
+}
+
+/* Start workers until there are 'want' of them (or as many as can be had) */
+static unsigned int jh_pool_start(const unsigned int want)
+{
+	pthread_t thread;
+
+	while (jh_pool_workers < want) {
+		if (pthread_create(&thread, NULL, jh_pool_worker, NULL) != 0) break;
+		pthread_detach(thread);
+		jh_pool_workers++;
+	}
+	return jh_pool_workers;
+}
+
+extern void jh_parallel_for(const size_t n, unsigned int threads, const jh_task_t task, void *arg)
+{
+	unsigned int helpers;
+
+	if (threads == 0) threads = jh_pool_threads();
+	if (threads > JH_POOL_MAX) threads = JH_POOL_MAX;
+	if ((size_t)threads > n) threads = (unsigned int)n;
+	if (threads <= 1 || jh_pool_inside) {
+		for (size_t i = 0; i < n; i++) task(arg, i);
+		return;
+	}
+
+	pthread_mutex_lock(&jh_pool_job_lock);
+	jh_pool_inside = 1;
+	pthread_mutex_lock(&jh_pool_lock);
+	helpers = jh_pool_start(threads - 1);
+	if (helpers > threads - 1) helpers = threads - 1;
+	jh_job.task = task;
+	jh_job.arg = arg;
+	jh_job.n = n;
+	jh_job.next = 0;
+	jh_job.slots = helpers;
+	jh_job.generation++;
+	pthread_cond_broadcast(&jh_pool_wake);
+	pthread_mutex_unlock(&jh_pool_lock);
+
+	jh_pool_run(task, arg, n);
+
+	/* Workers that haven't joined by now aren't needed any more */
+	pthread_mutex_lock(&jh_pool_lock);
+	jh_job.slots = 0;
+	while (jh_job.busy > 0) pthread_cond_wait(&jh_pool_done, &jh_pool_lock);
+	pthread_mutex_unlock(&jh_pool_lock);
+	jh_pool_inside = 0;
+	pthread_mutex_unlock(&jh_pool_job_lock);
+	return;
+}
+#endif /* NO_THREADS */
@@ -0,0 +1,31 @@
+/* Jody Bruchon's fast hashing function (thread pool)
+ * See jody_hash.c for license information */
+
+#ifndef JODY_HASH_POOL_H
+#define JODY_HASH_POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* Work for jh_parallel_for(): called once for each index */
+typedef void (*jh_task_t)(void *arg, const size_t index);
+
+/* Threads used when 0 is asked for: the number of online CPUs, or
+ * JODY_HASH_THREADS from the environment */
+extern unsigned int jh_pool_threads(void);
+
+/* Run task(arg, i) for every i from 0 to n - 1 on up to 'threads'
+ * threads (0 for the default), the calling thread being one of them.
+ * The workers are started on first use and kept for later calls; with
+ * NO_THREADS everything runs in the calling thread, and so does a call
+ * made from inside a task. */
+extern void jh_parallel_for(const size_t n, unsigned int threads, const jh_task_t task, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* JODY_HASH_POOL_H */
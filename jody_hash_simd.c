@@ -13,15 +13,22 @@
 #include "jody_hash.h"
 #include "jody_hash_simd.h"
 
-#if (!defined NO_SSE2 || !defined NO_AVX2)
-const union UINT256 vec_constant = {
-	.v64[0] = JODY_HASH_CONSTANT,
-	.v64[1] = JODY_HASH_CONSTANT,
-	.v64[2] = JODY_HASH_CONSTANT,
-	.v64[3] = JODY_HASH_CONSTANT };
-const union UINT256 vec_constant_ror2 = {
-	.v64[0] = JODY_HASH_CONSTANT_ROR2,
-	.v64[1] = JODY_HASH_CONSTANT_ROR2,
-	.v64[2] = JODY_HASH_CONSTANT_ROR2,
-	.v64[3] = JODY_HASH_CONSTANT_ROR2 };
+#if (!defined NO_SSE2 || !defined NO_AVX2 || !defined NO_AVX512)
+/* One constant per jodyhash_t lane of a 256-bit vector */
+#define JH_C(a) (jodyhash_t)(a)
+#if JODY_HASH_WIDTH == 64
+ #define JH_VEC_INIT(a) { .vjh = { JH_C(a), JH_C(a), JH_C(a), JH_C(a) } }
+#endif
+#if JODY_HASH_WIDTH == 32
+ #define JH_VEC_INIT(a) { .vjh = { JH_C(a), JH_C(a), JH_C(a), JH_C(a), \
+		JH_C(a), JH_C(a), JH_C(a), JH_C(a) } }
+#endif
+#if JODY_HASH_WIDTH == 16
+ #define JH_VEC_INIT(a) { .vjh = { JH_C(a), JH_C(a), JH_C(a), JH_C(a), \
+		JH_C(a), JH_C(a), JH_C(a), JH_C(a), JH_C(a), JH_C(a), JH_C(a), JH_C(a), \
+		JH_C(a), JH_C(a), JH_C(a), JH_C(a) } }
+#endif
+
+const union UINT256 vec_constant = JH_VEC_INIT(JODY_HASH_CONSTANT);
+const union UINT256 vec_constant_ror2 = JH_VEC_INIT(JODY_HASH_CONSTANT_ROR2);
 #endif
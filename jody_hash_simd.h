@@ -8,52 +8,362 @@
 extern "C" {
 #endif
 
+#include <string.h>
 #include "jody_hash.h"
 
-/* Disable SIMD if not 64-bit width or not 64-bit x86 code */
-#if JODY_HASH_WIDTH != 64 || !defined __x86_64__ || SIZE_MAX == 0xffffffff || (defined NO_SSE2 && defined NO_AVX2)
+/* The x86 kernels need 64-bit x86 code; AVX-512 also needs 64-bit width */
+#if JODY_HASH_WIDTH != 64 && !defined NO_AVX512
+ #define NO_AVX512
+#endif
+#if !defined __x86_64__ || SIZE_MAX == 0xffffffff
  #ifndef NO_SSE2
   #define NO_SSE2
  #endif
  #ifndef NO_AVX2
   #define NO_AVX2
  #endif
+ #ifndef NO_AVX512
+  #define NO_AVX512
+ #endif
+ #ifndef NO_BMI2
+  #define NO_BMI2
+ #endif
+#endif
+
+/* The portable kernel needs GCC/Clang vector extensions */
+#if !defined __GNUC__ && !defined __clang__ && !defined NO_VECEXT
+ #define NO_VECEXT
+#endif
+
+/* No kernels left means no dispatch code either */
+#if defined NO_SSE2 && defined NO_AVX2 && defined NO_AVX512 && defined NO_BMI2 && defined NO_VECEXT
  #ifndef NO_SIMD
   #define NO_SIMD
  #endif
 #endif
 
-/* Use SIMD by default */
-#if !defined NO_SIMD
- #if defined __APPLE__
-  /* Mac OS X < 10.15 don't support aligned_alloc */
-  #include <x86intrin.h>
-  #define aligned_alloc(a,b) malloc(b)
-  #define ALIGNED_FREE(a) free(a)
- #elif defined _MSC_VER || defined _WIN32 || defined __MINGW32__
+/* Use x86 SIMD by default */
+#if !defined NO_SSE2 || !defined NO_AVX2 || !defined NO_AVX512 || !defined NO_BMI2
+ #if defined _MSC_VER
   /* Microsoft C/C++-compatible compiler */
   #include <intrin.h>
-  #define aligned_alloc(a,b) _aligned_malloc(b,a)
-  #define ALIGNED_FREE(a) _aligned_free(a)
  #elif (defined __GNUC__  || defined __clang__ ) && (defined __x86_64__  || defined __i386__ )
-  /* GCC or Clang targeting x86/x86-64 */
+  /* GCC or Clang targeting x86/x86-64 (including MinGW and Mac OS X) */
   #include <x86intrin.h>
-  #define ALIGNED_FREE(a) free(a)
  #endif
-#endif /* !NO_SIMD */
+#endif /* x86 SIMD */
+
+/* jodyhash_t lanes per 256 bits */
+#define JH_VEC_LANES (32 / sizeof(jodyhash_t))
+
+#if !defined NO_SSE2 || !defined NO_AVX2 || !defined NO_AVX512
 
-#if !defined NO_SSE2 || !defined NO_AVX2
 union UINT256 {
 	__m256i  v256;
 	__m128i  v128[2];
 	uint64_t v64[4];
+	jodyhash_t vjh[JH_VEC_LANES];
 };
 
 extern const union UINT256 vec_constant, vec_constant_ror2;
+
+/* Lane width specific shift/add intrinsics for the SSE2/AVX2 kernels */
+#if JODY_HASH_WIDTH == 64
+ #define JH_SSE_SRLI(a,b)  _mm_srli_epi64(a,b)
+ #define JH_SSE_SLLI(a,b)  _mm_slli_epi64(a,b)
+ #define JH_SSE_ADD(a,b)   _mm_add_epi64(a,b)
+ #define JH_AVX2_SRLI(a,b) _mm256_srli_epi64(a,b)
+ #define JH_AVX2_SLLI(a,b) _mm256_slli_epi64(a,b)
+ #define JH_AVX2_ADD(a,b)  _mm256_add_epi64(a,b)
+#endif
+#if JODY_HASH_WIDTH == 32
+ #define JH_SSE_SRLI(a,b)  _mm_srli_epi32(a,b)
+ #define JH_SSE_SLLI(a,b)  _mm_slli_epi32(a,b)
+ #define JH_SSE_ADD(a,b)   _mm_add_epi32(a,b)
+ #define JH_AVX2_SRLI(a,b) _mm256_srli_epi32(a,b)
+ #define JH_AVX2_SLLI(a,b) _mm256_slli_epi32(a,b)
+ #define JH_AVX2_ADD(a,b)  _mm256_add_epi32(a,b)
+#endif
+#if JODY_HASH_WIDTH == 16
+ #define JH_SSE_SRLI(a,b)  _mm_srli_epi16(a,b)
+ #define JH_SSE_SLLI(a,b)  _mm_slli_epi16(a,b)
+ #define JH_SSE_ADD(a,b)   _mm_add_epi16(a,b)
+ #define JH_AVX2_SRLI(a,b) _mm256_srli_epi16(a,b)
+ #define JH_AVX2_SLLI(a,b) _mm256_slli_epi16(a,b)
+ #define JH_AVX2_ADD(a,b)  _mm256_add_epi16(a,b)
+#endif
+#endif /* x86 vector kernels */
+
+/* Prefetch for reading with minimal cache pollution (never faults) */
+#if defined __GNUC__ || defined __clang__
+ #define JH_PREFETCH_NTA(a) __builtin_prefetch((a), 0, 0)
+#elif defined _MSC_VER && (defined _M_X64 || defined _M_IX86)
+ #define JH_PREFETCH_NTA(a) _mm_prefetch((const char *)(a), _MM_HINT_NTA)
+#else
+ #define JH_PREFETCH_NTA(a)
+#endif
+
+/* Large-input mode settings (see jh_hash_large()); the prefetch distance
+ * in bytes for a block of 'count' bytes, or zero for no prefetching */
+extern size_t jh_stream_threshold, jh_prefetch_distance;
+#define JH_PREFETCH_FOR(count) (((count) >= jh_stream_threshold) ? jh_prefetch_distance : 0)
+
+/* Optimization barrier: the compiler must treat the value as unknown */
+#if defined __GNUC__ || defined __clang__
+#define JH_OPAQUE(a) __asm__("" : "+r" (a))
+#else
+#define JH_OPAQUE(a)
+#endif
+
+/* One step of the hash chain in merged form (see jh_hash_words()):
+ * r = hash - previous element, s = previous element + element and
+ * f = element2, with s and f computed off of the chain */
+#define JH_CHAIN_STEP(r, s, f) do { r += s; r ^= f; r = JH_ROL2(r); } while (0)
+
+/* Hash whole jodyhash_t words with the scalar loop
+ *
+ * The textbook form of each step is: hash += e; hash ^= e2;
+ * hash = ROL2(hash); hash += e. The trailing "+= e" of one step and the
+ * leading "+= e" of the next are merged, so the loop carries
+ * r = hash - e(previous) and every step only needs add/xor/rotate on the
+ * dependency chain. All of the ROR/XOR/add-constant work on the elements
+ * is independent of the chain and is done four words at a time so the
+ * CPU can run it in the shadow of the chain.
+ *
+ * Compilers like to "simplify" (r + (a + b)) back to ((r + a) + b) and
+ * (r ^ (x ^ k)) to ((r ^ x) ^ k), which puts the work back on the chain;
+ * JH_OPAQUE() stops them from looking inside the precomputed values.
+ * This is shared by the generic code and the BMI2 kernel, which is the
+ * same loop built with rorx available. */
+static inline void jh_hash_words_prefetch(const jodyhash_t *data, jodyhash_t *hash, size_t length, const size_t prefetch)
+{
+	jodyhash_t e0, e1, e2, e3, f0, f1, f2, f3, s0, s1, s2, s3;
+	const jodyhash_t s_constant = (jodyhash_t)JODY_HASH_CONSTANT_ROR2;
+	jodyhash_t r, prev;
+
+	if (length == 0) return;
+	r = *hash;
+	prev = 0;
+
+	for (; length >= 4; length -= 4) {
+		if (prefetch != 0) JH_PREFETCH_NTA((const char *)data + prefetch);
+		e0 = data[0]; e1 = data[1]; e2 = data[2]; e3 = data[3];
+		f0 = JH_ROR(e0) ^ s_constant;
+		f1 = JH_ROR(e1) ^ s_constant;
+		f2 = JH_ROR(e2) ^ s_constant;
+		f3 = JH_ROR(e3) ^ s_constant;
+		e0 += JODY_HASH_CONSTANT; e1 += JODY_HASH_CONSTANT;
+		e2 += JODY_HASH_CONSTANT; e3 += JODY_HASH_CONSTANT;
+		s0 = prev + e0; s1 = e0 + e1; s2 = e1 + e2; s3 = e2 + e3;
+		prev = e3;
+		JH_OPAQUE(f0); JH_OPAQUE(f1); JH_OPAQUE(f2); JH_OPAQUE(f3);
+		JH_OPAQUE(s0); JH_OPAQUE(s1); JH_OPAQUE(s2); JH_OPAQUE(s3);
+
+		JH_CHAIN_STEP(r, s0, f0);
+		JH_CHAIN_STEP(r, s1, f1);
+		JH_CHAIN_STEP(r, s2, f2);
+		JH_CHAIN_STEP(r, s3, f3);
+		data += 4;
+	}
+	for (; length > 0; length--) {
+		e0 = *data;
+		f0 = JH_ROR(e0) ^ s_constant;
+		e0 += JODY_HASH_CONSTANT;
+		s0 = prev + e0;
+		prev = e0;
+		JH_OPAQUE(f0); JH_OPAQUE(s0);
+		JH_CHAIN_STEP(r, s0, f0);
+		data++;
+	}
+	*hash = r + prev;
+	return;
+}
+
+static inline void jh_hash_words(const jodyhash_t *data, jodyhash_t *hash, size_t length)
+{
+	jh_hash_words_prefetch(data, hash, length, 0);
+	return;
+}
+
+#if JODY_HASH_WIDTH == 64
+#define JH128_CHAIN_STEP(r, s, f) do { r += s; r ^= f; r = JH128_ROL2(r); } while (0)
+
+/* Hash whole words with both jodyhash128 chains
+ *
+ * This is jh_hash_words_prefetch() with a second chain next to the first.
+ * The chains don't depend on each other, so the CPU works on one while
+ * the other waits for its add/xor/rotate. The elements of the two chains
+ * only differ by the difference of the constants, so the second chain's
+ * sums of neighbouring elements are the first chain's plus twice that.
+ * To make that hold for the very first word too (where the previous
+ * element is zero for both chains), the second chain starts out as if
+ * its previous element was the difference: r = hash - difference. */
+static inline void jh_hash_words128_prefetch(const jodyhash_t *data, jodyhash128_t *hash, size_t length, const size_t prefetch)
+{
+	const jodyhash_t sa_constant = (jodyhash_t)JODY_HASH_CONSTANT_ROR2;
+	const jodyhash_t sb_constant = (jodyhash_t)JODY_HASH128_CONSTANT_ROR2;
+	const jodyhash_t diff = (jodyhash_t)(JODY_HASH128_CONSTANT - JODY_HASH_CONSTANT);
+	jodyhash_t e0, e1, e2, e3, fa0, fa1, fa2, fa3, fb0, fb1, fb2, fb3;
+	jodyhash_t sa0, sa1, sa2, sa3, sb0, sb1, sb2, sb3;
+	jodyhash_t ra, rb, prev;
+
+	if (length == 0) return;
+	ra = hash->lo;
+	rb = hash->hi - diff;
+	prev = 0;
+
+	for (; length >= 4; length -= 4) {
+		if (prefetch != 0) JH_PREFETCH_NTA((const char *)data + prefetch);
+		e0 = data[0]; e1 = data[1]; e2 = data[2]; e3 = data[3];
+		fa0 = JH_ROR(e0) ^ sa_constant;
+		fa1 = JH_ROR(e1) ^ sa_constant;
+		fa2 = JH_ROR(e2) ^ sa_constant;
+		fa3 = JH_ROR(e3) ^ sa_constant;
+		fb0 = JH128_ROR(e0) ^ sb_constant;
+		fb1 = JH128_ROR(e1) ^ sb_constant;
+		fb2 = JH128_ROR(e2) ^ sb_constant;
+		fb3 = JH128_ROR(e3) ^ sb_constant;
+		e0 += JODY_HASH_CONSTANT; e1 += JODY_HASH_CONSTANT;
+		e2 += JODY_HASH_CONSTANT; e3 += JODY_HASH_CONSTANT;
+		sa0 = prev + e0; sa1 = e0 + e1; sa2 = e1 + e2; sa3 = e2 + e3;
+		prev = e3;
+		sb0 = sa0 + 2 * diff; sb1 = sa1 + 2 * diff; sb2 = sa2 + 2 * diff; sb3 = sa3 + 2 * diff;
+		JH_OPAQUE(fa0); JH_OPAQUE(fa1); JH_OPAQUE(fb0); JH_OPAQUE(fb1);
+		JH_OPAQUE(sa0); JH_OPAQUE(sa1); JH_OPAQUE(sb0); JH_OPAQUE(sb1);
+		JH_OPAQUE(fa2); JH_OPAQUE(fa3); JH_OPAQUE(fb2); JH_OPAQUE(fb3);
+		JH_OPAQUE(sa2); JH_OPAQUE(sa3); JH_OPAQUE(sb2); JH_OPAQUE(sb3);
+
+		JH_CHAIN_STEP(ra, sa0, fa0);
+		JH128_CHAIN_STEP(rb, sb0, fb0);
+		JH_CHAIN_STEP(ra, sa1, fa1);
+		JH128_CHAIN_STEP(rb, sb1, fb1);
+		JH_CHAIN_STEP(ra, sa2, fa2);
+		JH128_CHAIN_STEP(rb, sb2, fb2);
+		JH_CHAIN_STEP(ra, sa3, fa3);
+		JH128_CHAIN_STEP(rb, sb3, fb3);
+		data += 4;
+	}
+	for (; length > 0; length--) {
+		e0 = *data;
+		fa0 = JH_ROR(e0) ^ sa_constant;
+		fb0 = JH128_ROR(e0) ^ sb_constant;
+		e0 += JODY_HASH_CONSTANT;
+		sa0 = prev + e0;
+		sb0 = sa0 + 2 * diff;
+		prev = e0;
+		JH_OPAQUE(fa0); JH_OPAQUE(fb0); JH_OPAQUE(sa0); JH_OPAQUE(sb0);
+		JH_CHAIN_STEP(ra, sa0, fa0);
+		JH128_CHAIN_STEP(rb, sb0, fb0);
+		data++;
+	}
+	hash->lo = ra + prev;
+	hash->hi = rb + prev + diff;
+	return;
+}
+#endif /* JODY_HASH_WIDTH == 64 */
+
+
+/* Load the last 0-7 bytes of a key as the low bytes of a word without
+ * reading past them; little-endian only (the multi-buffer kernels)
+ *
+ * Key lengths are random, so branching on them would mispredict all the
+ * time. The 4, 2 and 1 byte pieces that make up the tail are loaded from
+ * either the key or a block of zeroes, which compiles to selects. */
+static const unsigned char jh_zero_bytes[4] = { 0, 0, 0, 0 };
+static inline uint64_t jh_load_tail64(const unsigned char *p, const size_t n)
+{
+	const unsigned char *p4, *p2, *p1;
+	uint32_t v4;
+	uint16_t v2;
+	uint8_t v1;
+
+	p4 = (n & 4) ? p : jh_zero_bytes;
+	p2 = (n & 2) ? p + (n & 4) : jh_zero_bytes;
+	p1 = (n & 1) ? p + (n & 6) : jh_zero_bytes;
+	/* Without this the compiler "knows" the zero loads and branches again */
+	JH_OPAQUE(p4); JH_OPAQUE(p2); JH_OPAQUE(p1);
+	memcpy(&v4, p4, 4);
+	memcpy(&v2, p2, 2);
+	v1 = *p1;
+	return (uint64_t)v4 | ((uint64_t)v2 << (8 * (n & 4))) | ((uint64_t)v1 << (8 * (n & 6)));
+}
+
+
+/* Kernels hash as much of the data as they can, advance *data past it,
+ * and set *length to the number of whole words left for the scalar loop */
+typedef int (*jh_kernel_t)(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length);
+
+/* Wide kernels run the jodyhash-wide lanes over whole stripes */
+typedef void (*jh_wide_kernel_t)(const jodyhash_t *data, jodyhash_t *lanes, size_t stripes);
+
+/* jodyhash128 kernels hash whole words with both chains (there is no
+ * jodyhash128 at other widths; the type keeps the kernel table the same) */
+#if JODY_HASH_WIDTH == 64
+typedef void (*jh_kernel128_t)(const jodyhash_t *data, jodyhash128_t *hash, const size_t length);
+#else
+typedef void (*jh_kernel128_t)(void);
 #endif
 
+/* Multi-buffer kernels hash whole groups of keys (one per vector lane)
+ * and return how many keys they did; the caller does the rest */
+typedef size_t (*jh_multi_kernel_t)(const void * const *bufs, const size_t *lens, jodyhash_t *out, const size_t n);
+
+/* Chunk boundary scan kernels do the same as jh_cdc_scan() */
+typedef size_t (*jh_cdc_kernel_t)(const unsigned char *data, size_t i, const size_t mid,
+		const size_t end, const uint32_t mask_s, const uint32_t mask_l);
+/* The boundary scan kernel picked by the dispatch code, or NULL */
+extern jh_cdc_kernel_t jh_cdc_kernel(void);
+
+
+/* Content-defined chunking (see jody_hash_cdc.c)
+ *
+ * The Gear hash at byte i is the sum of gear[byte] << k over the last
+ * JODY_CDC_WINDOW bytes, k being how far back the byte is; older bytes
+ * shift out of the 32 bits. The table entries are fmix32(byte + seed),
+ * which lets vector code compute them instead of looking them up. */
+#define JH_CDC_GEAR_SEED 0x8748ee5dU
+#define JH_CDC_FMIX_M1 0x85ebca6bU
+#define JH_CDC_FMIX_M2 0xc2b2ae35U
+extern const uint32_t jh_cdc_gear[256];
+
+/* Find the first i from i to end - 1 where the hash of the window that
+ * ends at data[i] has none of the mask_s bits set (before mid) or of the
+ * mask_l bits set (from mid on); end if there is none. There must be
+ * JODY_CDC_WINDOW - 1 bytes before data[i]. */
+static inline size_t jh_cdc_scan(const unsigned char *data, size_t i, const size_t mid,
+		const size_t end, const uint32_t mask_s, const uint32_t mask_l)
+{
+	uint32_t h = 0;
+
+	for (size_t j = i - (JODY_CDC_WINDOW - 1); j < i; j++) h = (h << 1) + jh_cdc_gear[data[j]];
+	for (; i < mid && i < end; i++) {
+		h = (h << 1) + jh_cdc_gear[data[i]];
+		if ((h & mask_s) == 0) return i;
+	}
+	for (; i < end; i++) {
+		h = (h << 1) + jh_cdc_gear[data[i]];
+		if ((h & mask_l) == 0) return i;
+	}
+	return end;
+}
+
+extern int jody_block_hash_avx512(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length);
 extern int jody_block_hash_avx2(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length);
 extern int jody_block_hash_sse2(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length);
+extern int jody_block_hash_bmi2(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length);
+extern int jody_block_hash_vec(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length);
+extern void jody_block_hash_wide_avx2(const jodyhash_t *data, jodyhash_t *lanes, size_t stripes);
+extern void jody_block_hash_wide_sse2(const jodyhash_t *data, jodyhash_t *lanes, size_t stripes);
+extern size_t jody_cdc_scan_avx512(const unsigned char *data, size_t i, const size_t mid,
+		const size_t end, const uint32_t mask_s, const uint32_t mask_l);
+
+/* One 64-bit hash per lane (or two 64-bit chains), so these only exist
+ * at 64-bit width */
+#if JODY_HASH_WIDTH == 64
+extern size_t jody_block_hash_multi_avx512(const void * const *bufs, const size_t *lens, jodyhash_t *out, const size_t n);
+extern size_t jody_block_hash_multi_avx2(const void * const *bufs, const size_t *lens, jodyhash_t *out, const size_t n);
+extern void jody_block_hash128_avx2(const jodyhash_t *data, jodyhash128_t *hash, const size_t length);
+#endif
 
 #ifdef __cplusplus
 }
@@ -20,94 +20,116 @@
 int jody_block_hash_sse2(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length)
 {
 	size_t vec_allocsize;
-	__m128i *aligned_data;
+	const __m128i *vec_data;
 	__m128i v1, v2, v3, v4, v5, v6;
-	__m128 vzero;
 	__m128i vec_const, vec_ror2;
+	/* Chain state in merged form, see jh_hash_words() */
+	union UINT256 ep1, ep2;
+	jodyhash_t r = *hash, prev = 0;
+	jodyhash_t s0, f0;
+	const size_t prefetch = JH_PREFETCH_FOR(count);
 
-#if defined __GNUC__ || defined __clang__
-	__builtin_cpu_init ();
-	if (__builtin_cpu_supports ("avx")) {
-		asm volatile ("vzeroall" : : :
-			"ymm0", "ymm1", "ymm2", "ymm3", "ymm4", "ymm5", "ymm6", "ymm7",
-			"ymm8", "ymm9", "ymm10", "ymm11", "ymm12", "ymm13", "ymm14", "ymm15");
-	}
-#endif /* __GNUC__ || __clang__ */
+	/* No vzeroall here: every AVX2 and AVX-512 kernel (block, multi,
+	 * wide, 128-bit and chunking) relies on the compiler ending it with
+	 * vzeroupper, so the upper halves are clean by the time any SSE2
+	 * code runs */
 
 	/* Constants preload */
 	vec_const = _mm_load_si128(&vec_constant.v128[0]);
 	vec_ror2  = _mm_load_si128(&vec_constant_ror2.v128[0]);
-	vzero = _mm_setzero_ps();
 
-	/* How much memory do we need to align the data? */
+	/* Data is read in place with unaligned loads; MOVDQU on aligned data
+	 * costs the same as MOVDQA on anything newer than Core 2, so there is
+	 * no reason to copy into an aligned scratch buffer first */
 	vec_allocsize = count & 0xffffffffffffffe0U;
-	/* Only alloc/copy if not already aligned */
-	if (((uintptr_t)*data & (uintptr_t)0x0fULL) != 0) {
-		aligned_data  = (__m128i *)aligned_alloc(16, vec_allocsize);
-		if (!aligned_data) return 1;
-		memcpy(aligned_data, *data, vec_allocsize);
-	} else aligned_data = (__m128i *)*data;
+	vec_data = (const __m128i *)*data;
 
 	for (size_t i = 0; i < (vec_allocsize / 16); i++) {
-		v1  = _mm_load_si128(&aligned_data[i]);
-		v3  = _mm_load_si128(&aligned_data[i]);
+		if (prefetch != 0) JH_PREFETCH_NTA((const char *)&vec_data[i] + prefetch);
+		v3  = _mm_loadu_si128(&vec_data[i]);
+		v1  = v3;
 		i++;
-		v4  = _mm_load_si128(&aligned_data[i]);
-		v6  = _mm_load_si128(&aligned_data[i]);
+		v6  = _mm_loadu_si128(&vec_data[i]);
+		v4  = v6;
 
 		/* "element2" gets RORed (two logical shifts ORed together) */
-		v1  = _mm_srli_epi64(v1, JODY_HASH_SHIFT);
-		v2  = _mm_slli_epi64(v3, (64 - JODY_HASH_SHIFT));
+		v1  = JH_SSE_SRLI(v1, JODY_HASH_SHIFT);
+		v2  = JH_SSE_SLLI(v3, (JODY_HASH_WIDTH - JODY_HASH_SHIFT));
 		v1  = _mm_or_si128(v1, v2);
 		v1  = _mm_xor_si128(v1, vec_ror2);  // XOR against the ROR2 constant
-		v4  = _mm_srli_epi64(v4, JODY_HASH_SHIFT);
-		v5  = _mm_slli_epi64(v6, (64 - JODY_HASH_SHIFT));
+		v4  = JH_SSE_SRLI(v4, JODY_HASH_SHIFT);
+		v5  = JH_SSE_SLLI(v6, (JODY_HASH_WIDTH - JODY_HASH_SHIFT));
 		v4  = _mm_or_si128(v4, v5);
 		v4  = _mm_xor_si128(v4, vec_ror2);  // XOR against the ROR2 constant
 
 		/* Add the constant to "element" */
-		v3  = _mm_add_epi64(v3,  vec_const);
-		v6  = _mm_add_epi64(v6,  vec_const);
+		v3  = JH_SSE_ADD(v3,  vec_const);
+		v6  = JH_SSE_ADD(v6,  vec_const);
 
 		/* Perform the rest of the hash */
-		for (int j = 0; j < 4; j++) {
-			uint64_t ep1, ep2;
-			switch (j) {
-				default:
-				case 0:
-				/* Lower v1-v3 */
-				ep1 = (uint64_t)_mm_cvtsi128_si64(v3);
-				ep2 = (uint64_t)_mm_cvtsi128_si64(v1);
-				break;
-
-				case 1:
-				/* Upper v1-v3 */
-				ep1 = (uint64_t)_mm_cvtsi128_si64(_mm_castps_si128(_mm_movehl_ps(vzero, _mm_castsi128_ps(v3))));
-				ep2 = (uint64_t)_mm_cvtsi128_si64(_mm_castps_si128(_mm_movehl_ps(vzero, _mm_castsi128_ps(v1))));
-				break;
-
-				case 2:
-				/* Lower v4-v6 */
-				ep1 = (uint64_t)_mm_cvtsi128_si64(v6);
-				ep2 = (uint64_t)_mm_cvtsi128_si64(v4);
-				break;
-
-				case 3:
-				/* Upper v4-v6 */
-				ep1 = (uint64_t)_mm_cvtsi128_si64(_mm_castps_si128(_mm_movehl_ps(vzero, _mm_castsi128_ps(v6))));
-				ep2 = (uint64_t)_mm_cvtsi128_si64(_mm_castps_si128(_mm_movehl_ps(vzero, _mm_castsi128_ps(v4))));
-				break;
-			}
-			*hash += ep1;
-			*hash ^= ep2;
-			*hash = JH_ROL2(*hash);
-			*hash += ep1;
-			}  // End of hash finish loop
+		ep1.v128[0] = v3;
+		ep1.v128[1] = v6;
+		ep2.v128[0] = v1;
+		ep2.v128[1] = v4;
+		for (size_t j = 0; j < JH_VEC_LANES; j++) {
+			s0 = prev + ep1.vjh[j];
+			prev = ep1.vjh[j];
+			f0 = ep2.vjh[j];
+			JH_OPAQUE(s0);
+			JH_CHAIN_STEP(r, s0, f0);
+		}  // End of hash finish loop
 		}  // End of main SSE for loop
+	*hash = r + prev;
 	*data += vec_allocsize / sizeof(jodyhash_t);
-	if (((uintptr_t)*data & (uintptr_t)0x0fULL) != 0) ALIGNED_FREE(aligned_data);
 	*length = (count - vec_allocsize) / sizeof(jodyhash_t);
 	return 0;
 }
 
+/* jodyhash-wide: one hash step on a vector of lanes 'a' with data 'v' */
+#define JH_WIDE_STEP_SSE2(a, v) do { \
+	__m128i e_, f_; \
+	f_ = _mm_or_si128(JH_SSE_SRLI(v, JODY_HASH_SHIFT), JH_SSE_SLLI(v, (JODY_HASH_WIDTH - JODY_HASH_SHIFT))); \
+	f_ = _mm_xor_si128(f_, vec_ror2); \
+	e_ = JH_SSE_ADD(v, vec_const); \
+	a = JH_SSE_ADD(a, e_); \
+	a = _mm_xor_si128(a, f_); \
+	a = _mm_or_si128(JH_SSE_SLLI(a, JH_SHIFT2), JH_SSE_SRLI(a, (JODY_HASH_WIDTH - JH_SHIFT2))); \
+	a = JH_SSE_ADD(a, e_); \
+} while (0)
+
+/* jodyhash-wide stripes: a 64-byte stripe is four vectors of lanes and
+ * the whole hash step runs on all of them side by side */
+void jody_block_hash_wide_sse2(const jodyhash_t *data, jodyhash_t *lanes, size_t stripes)
+{
+	const __m128i *vec_data = (const __m128i *)(const void *)data;
+	__m128i a0, a1, a2, a3, v0, v1, v2, v3;
+	__m128i vec_const, vec_ror2;
+	const size_t prefetch = JH_PREFETCH_FOR(stripes * JODY_HASH_WIDE_STRIPE);
+
+	vec_const = _mm_load_si128(&vec_constant.v128[0]);
+	vec_ror2  = _mm_load_si128(&vec_constant_ror2.v128[0]);
+
+	a0 = _mm_loadu_si128((const __m128i *)(const void *)lanes);
+	a1 = _mm_loadu_si128((const __m128i *)(const void *)lanes + 1);
+	a2 = _mm_loadu_si128((const __m128i *)(const void *)lanes + 2);
+	a3 = _mm_loadu_si128((const __m128i *)(const void *)lanes + 3);
+	for (; stripes > 0; stripes--) {
+		if (prefetch != 0) JH_PREFETCH_NTA((const char *)vec_data + prefetch);
+		v0 = _mm_loadu_si128(&vec_data[0]);
+		v1 = _mm_loadu_si128(&vec_data[1]);
+		v2 = _mm_loadu_si128(&vec_data[2]);
+		v3 = _mm_loadu_si128(&vec_data[3]);
+		JH_WIDE_STEP_SSE2(a0, v0);
+		JH_WIDE_STEP_SSE2(a1, v1);
+		JH_WIDE_STEP_SSE2(a2, v2);
+		JH_WIDE_STEP_SSE2(a3, v3);
+		vec_data += 4;
+	}
+	_mm_storeu_si128((__m128i *)(void *)lanes, a0);
+	_mm_storeu_si128((__m128i *)(void *)lanes + 1, a1);
+	_mm_storeu_si128((__m128i *)(void *)lanes + 2, a2);
+	_mm_storeu_si128((__m128i *)(void *)lanes + 3, a3);
+	return;
+}
+
 #endif /* NO_SSE2 */
@@ -0,0 +1,171 @@
+/* Jody Bruchon's fast hashing function: tree hashing
+ *
+ * The data is cut into leaves of a fixed size that are hashed on their
+ * own (so they can be hashed in parallel, and one leaf can be hashed
+ * again without the rest) and the leaf hashes are then hashed together
+ * in a binary tree. See jody_hash.h for the exact tree.
+ *
+ * The rolling hash is the flat version: the block hashes are simply
+ * XORed together.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "jody_hash.h"
+#include "jody_hash_pool.h"
+
+struct jh_tree_leaves {
+	const unsigned char *data;
+	size_t count;
+	size_t leafsize;
+	jodyhash_t *leaves;
+	int error;	/* set by any thread, so atomically */
+};
+
+static void jh_tree_leaf(void *arg, const size_t index)
+{
+	struct jh_tree_leaves *job = (struct jh_tree_leaves *)arg;
+	const size_t offset = index * job->leafsize;
+	const size_t len = (job->count - offset < job->leafsize) ? job->count - offset : job->leafsize;
+
+	job->leaves[index] = 0;
+	if (jody_block_hash((jodyhash_t *)(uintptr_t)(job->data + offset), &job->leaves[index], len) != 0)
+		__atomic_store_n(&job->error, 1, __ATOMIC_RELAXED);
+	return;
+}
+
+/* Hash each leaf of the data (see jody_hash.h) */
+extern int jody_tree_leaves(const void *data, const size_t count, const size_t leafsize,
+		const unsigned int threads, jodyhash_t *leaves)
+{
+	struct jh_tree_leaves job;
+
+	if (leafsize == 0 || (leafsize & (sizeof(jodyhash_t) - 1)) != 0) return 1;
+	if (count == 0) {
+		leaves[0] = 0;
+		return 0;
+	}
+	job.data = (const unsigned char *)data;
+	job.count = count;
+	job.leafsize = leafsize;
+	job.leaves = leaves;
+	job.error = 0;
+	/* Calibrate before the workers start so they don't skew the timings */
+	jody_hash_kernel(NULL);
+	jh_parallel_for(JODY_TREE_LEAVES(count, leafsize), threads, jh_tree_leaf, &job);
+	return job.error;
+}
+
+
+/* Root of the tree over n leaves: the left subtree gets the largest power
+ * of two leaves less than n, which is the same tree as pairing the nodes
+ * of each level and carrying an odd one at the end up unchanged */
+static jodyhash_t jh_tree_node(const jodyhash_t *leaves, const size_t n)
+{
+	jodyhash_t children[2], hash = (jodyhash_t)JODY_HASH_CONSTANT;
+	size_t left = 1;
+
+	if (n == 1) return leaves[0];
+	while (left * 2 < n) left *= 2;
+	children[0] = jh_tree_node(leaves, left);
+	children[1] = jh_tree_node(leaves + left, n - left);
+	jody_block_hash(children, &hash, sizeof(children));
+	return hash;
+}
+
+/* Hash the leaf hashes together into the root (see jody_hash.h) */
+extern int jody_tree_root(const jodyhash_t *leaves, const size_t n, jodyhash_t *root)
+{
+	if (n == 0) return 1;
+	*root = jh_tree_node(leaves, n);
+	return 0;
+}
+
+
+/* Tree hash a whole buffer (see jody_hash.h) */
+extern int jody_tree_hash(const void *data, const size_t count, const size_t leafsize,
+		const unsigned int threads, jodyhash_t *root)
+{
+	jodyhash_t *leaves;
+	size_t n;
+	int error;
+
+	if (leafsize == 0) return 1;
+	n = JODY_TREE_LEAVES(count, leafsize);
+	leaves = (jodyhash_t *)malloc(n * sizeof(jodyhash_t));
+	if (leaves == NULL) return 1;
+	error = jody_tree_leaves(data, count, leafsize, threads, leaves);
+	if (error == 0) error = jody_tree_root(leaves, n, root);
+	free(leaves);
+	return error;
+}
+
+
+/* Rolling hash work is handed out in runs of blocks of at least this
+ * many bytes, so that threads don't fight over every 4 KiB block */
+#define JH_ROLL_RUN 262144
+
+struct jh_roll_runs {
+	const unsigned char *data;
+	size_t count;
+	size_t blocksize;
+	size_t run;
+	jodyhash_t *hashes;
+	int error;	/* set by any thread, so atomically */
+};
+
+/* XOR of the block hashes of count bytes from data */
+static int jh_roll(const unsigned char *data, const size_t count, const size_t blocksize, jodyhash_t *hash)
+{
+	jodyhash_t block;
+	size_t len;
+
+	for (size_t off = 0; off < count; off += len) {
+		len = (count - off < blocksize) ? count - off : blocksize;
+		block = 0;
+		if (jody_block_hash((jodyhash_t *)(uintptr_t)(data + off), &block, len) != 0) return 1;
+		*hash ^= block;
+	}
+	return 0;
+}
+
+static void jh_roll_run(void *arg, const size_t index)
+{
+	struct jh_roll_runs *job = (struct jh_roll_runs *)arg;
+	const size_t offset = index * job->run;
+	const size_t len = (job->count - offset < job->run) ? job->count - offset : job->run;
+
+	job->hashes[index] = 0;
+	if (jh_roll(job->data + offset, len, job->blocksize, &job->hashes[index]) != 0)
+		__atomic_store_n(&job->error, 1, __ATOMIC_RELAXED);
+	return;
+}
+
+/* Rolling hash of a buffer (see jody_hash.h) */
+extern int jody_rolling_hash(const void *data, const size_t count, const size_t blocksize,
+		const unsigned int threads, jodyhash_t *hash)
+{
+	struct jh_roll_runs job;
+	size_t n;
+
+	if (blocksize == 0) return 1;
+	job.data = (const unsigned char *)data;
+	job.count = count;
+	job.blocksize = blocksize;
+	job.run = (blocksize < JH_ROLL_RUN) ? JH_ROLL_RUN - (JH_ROLL_RUN % blocksize) : blocksize;
+	n = (count + job.run - 1) / job.run;
+	if (n < 2 || threads == 1) return jh_roll(job.data, count, blocksize, hash);
+
+	/* Each run gets a partial XOR; they are put together at the end */
+	job.hashes = (jodyhash_t *)malloc(n * sizeof(jodyhash_t));
+	if (job.hashes == NULL) return jh_roll(job.data, count, blocksize, hash);
+	job.error = 0;
+	jody_hash_kernel(NULL);
+	jh_parallel_for(n, threads, jh_roll_run, &job);
+	for (size_t i = 0; i < n; i++) *hash ^= job.hashes[i];
+	free(job.hashes);
+	return job.error;
+}
@@ -0,0 +1,72 @@
+/* Jody Bruchon's fast hashing function
+ *
+ * This function was written to generate a fast hash that also has a
+ * fairly low collision rate. The collision rate is much higher than
+ * a secure hash algorithm, but the calculation is drastically simpler
+ * and faster.
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jody_hash.h"
+#include "jody_hash_simd.h"
+
+#ifndef NO_VECEXT
+
+/* Portable kernel written with GCC/Clang generic vectors instead of
+ * intrinsics. It does the same element precomputation as the SSE2/AVX2
+ * kernels and lets the compiler pick the instructions (NEON, AltiVec,
+ * SSE2, ...), falling back to plain scalar code on targets without
+ * vector units. Any hash width works since lanes are just jodyhash_t. */
+
+#define JH_VEC_BYTES 32
+typedef jodyhash_t jh_vec_t __attribute__((vector_size(JH_VEC_BYTES)));
+
+int jody_block_hash_vec(jodyhash_t **data, jodyhash_t *hash, const size_t count, size_t *length)
+{
+	size_t vec_allocsize;
+	const unsigned char *vec_data;
+	/* v1 = ROR/XOR work ("element2"), v3 = data+constant ("element") */
+	jh_vec_t v1, v3;
+	const jodyhash_t vec_const = (jodyhash_t)JODY_HASH_CONSTANT;
+	const jodyhash_t vec_ror2 = (jodyhash_t)JODY_HASH_CONSTANT_ROR2;
+	/* Chain state in merged form, see jh_hash_words() */
+	jodyhash_t r = *hash, prev = 0;
+	jodyhash_t s0, f0;
+	const size_t prefetch = JH_PREFETCH_FOR(count);
+
+	vec_allocsize = count & ~((size_t)JH_VEC_BYTES - 1);
+	vec_data = (const unsigned char *)*data;
+
+	for (size_t i = 0; i < vec_allocsize; i += JH_VEC_BYTES) {
+		if (prefetch != 0) JH_PREFETCH_NTA(vec_data + i + prefetch);
+		/* memcpy() is how generic vectors do unaligned loads */
+		memcpy(&v3, vec_data + i, JH_VEC_BYTES);
+
+		/* "element2" gets RORed and XORed against the ROR2 constant */
+		v1  = (v3 >> JODY_HASH_SHIFT) | (v3 << (JODY_HASH_WIDTH - JODY_HASH_SHIFT));
+		v1 ^= vec_ror2;
+
+		/* Add the constant to "element" */
+		v3 += vec_const;
+
+		/* Perform the rest of the hash */
+		for (size_t j = 0; j < JH_VEC_LANES; j++) {
+			s0 = prev + v3[j];
+			prev = v3[j];
+			f0 = v1[j];
+			JH_OPAQUE(s0);
+			JH_CHAIN_STEP(r, s0, f0);
+		}  // End of hash finish loop
+	}  // End of main vector for loop
+	*hash = r + prev;
+	*data += vec_allocsize / sizeof(jodyhash_t);
+	*length = (count - vec_allocsize) / sizeof(jodyhash_t);
+	return 0;
+}
+
+#endif /* NO_VECEXT */
@@ -0,0 +1,1101 @@
+/* jodyhash self-test: compares jody_block_hash() against a plain
+ * reference implementation for many lengths and buffer alignments
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "jody_hash.h"
+
+#ifndef _WIN32
+ #include <sys/mman.h>
+ #include <sys/uio.h>
+ #include <unistd.h>
+#endif
+
+#define TESTSIZE 1024
+#define MAXOFFSET 32
+/* Exit status for a kernel that isn't available (as in automake) */
+#define SELFTEST_SKIPPED 77
+
+/* Distribution tests for jody_block_hash_k() */
+#define KMAX 8
+#define KDIST 4
+#define KEYSIZE 6
+#define BUCKETS 61
+#define BLOOM_KEYS 4096U
+#define BLOOM_BITS 40000U
+#define BLOOM_K 7
+
+/* Content-defined chunking tests */
+#define CDCSIZE 65536
+#define CDCZEROES 8192
+#define CDCMAXCHUNKS (CDCSIZE / JODY_CDC_MIN_SIZE + 1)
+
+/* rsync-style delta tests */
+#define DELTASIZE 65536
+#define DELTAMAXBLOCKS (DELTASIZE / 64 + 1)
+
+static int failures = 0;
+
+#ifndef _WIN32
+/* The end of a page that is followed by an inaccessible one; reading
+ * past data that is put right before it crashes the test */
+static unsigned char *guard_end = NULL;
+static size_t guard_size;
+#endif
+
+/* Straightforward word-at-a-time implementation of the algorithm */
+static jodyhash_t ref_hash(const unsigned char *data, jodyhash_t hash, size_t count)
+{
+	const jodyhash_t s_constant = JH_ROR2(JODY_HASH_CONSTANT);
+	jodyhash_t element, element2;
+	size_t rem = count % sizeof(jodyhash_t);
+
+	for (; count >= sizeof(jodyhash_t); count -= sizeof(jodyhash_t)) {
+		memcpy(&element, data, sizeof(jodyhash_t));
+		element2 = JH_ROR(element);
+		element2 ^= s_constant;
+		element += JODY_HASH_CONSTANT;
+		hash += element;
+		hash ^= element2;
+		hash = JH_ROL2(hash);
+		hash += element;
+		data += sizeof(jodyhash_t);
+	}
+	if (rem) {
+		element = 0;
+		memcpy(&element, data, rem);
+		element2 = JH_ROR(element);
+		element2 ^= s_constant;
+		element += JODY_HASH_CONSTANT;
+		hash += element;
+		hash ^= element2;
+		hash = JH_ROL2(hash);
+		hash += element2;
+	}
+	return hash;
+}
+
+/* jodyhash-wide spelled out: lanes per stripe, fold, then the rest */
+static jodyhash_t ref_hash_wide(const unsigned char *data, jodyhash_t hash, size_t count)
+{
+	const jodyhash_t s_constant = JH_ROR2(JODY_HASH_CONSTANT);
+	jodyhash_t lanes[JODY_HASH_WIDE_LANES];
+	jodyhash_t element, element2;
+	const size_t stripes = count / JODY_HASH_WIDE_STRIPE;
+
+	if (stripes == 0) return ref_hash(data, hash, count);
+	for (size_t l = 0; l < JODY_HASH_WIDE_LANES; l++)
+		lanes[l] = (jodyhash_t)(hash + (jodyhash_t)l * JODY_HASH_CONSTANT);
+	for (size_t i = 0; i < stripes; i++) {
+		for (size_t l = 0; l < JODY_HASH_WIDE_LANES; l++) {
+			memcpy(&element, data, sizeof(jodyhash_t));
+			element2 = JH_ROR(element);
+			element2 ^= s_constant;
+			element += JODY_HASH_CONSTANT;
+			lanes[l] += element;
+			lanes[l] ^= element2;
+			lanes[l] = JH_ROL2(lanes[l]);
+			lanes[l] += element;
+			data += sizeof(jodyhash_t);
+		}
+	}
+	hash = ref_hash((const unsigned char *)lanes, hash, JODY_HASH_WIDE_STRIPE);
+	return ref_hash(data, hash, count - (stripes * JODY_HASH_WIDE_STRIPE));
+}
+
+#if JODY_HASH_WIDTH == 64
+/* The second jodyhash128 chain: ref_hash() with the other shift and constant */
+static jodyhash_t ref_hash128_hi(const unsigned char *data, jodyhash_t hash, size_t count)
+{
+	const jodyhash_t s_constant = (jodyhash_t)JODY_HASH128_CONSTANT_ROR2;
+	jodyhash_t element, element2;
+	size_t rem = count % sizeof(jodyhash_t);
+
+	for (; count >= sizeof(jodyhash_t); count -= sizeof(jodyhash_t)) {
+		memcpy(&element, data, sizeof(jodyhash_t));
+		element2 = JH128_ROR(element);
+		element2 ^= s_constant;
+		element += JODY_HASH128_CONSTANT;
+		hash += element;
+		hash ^= element2;
+		hash = JH128_ROL2(hash);
+		hash += element;
+		data += sizeof(jodyhash_t);
+	}
+	if (rem) {
+		element = 0;
+		memcpy(&element, data, rem);
+		element2 = JH128_ROR(element);
+		element2 ^= s_constant;
+		element += JODY_HASH128_CONSTANT;
+		hash += element;
+		hash ^= element2;
+		hash = JH128_ROL2(hash);
+		hash += element2;
+	}
+	return hash;
+}
+#endif /* JODY_HASH_WIDTH == 64 */
+
+/* ref_hash() for any width, with that width's default shift and constant */
+static uint64_t ref_hash_width(const unsigned char *data, size_t count, const unsigned int width)
+{
+	const uint64_t mask = (width == 64) ? UINT64_MAX : ((uint64_t)1 << width) - 1;
+	const uint64_t constant = (width == 64) ? 0x71812e0f5463d3c8ULL : (width == 32) ? 0x8748ee5dU : 0x1f5bU;
+	const unsigned int shift = 14, shift2 = (28 > width) ? 28 - width : 28;
+	const size_t bytes = width / 8;
+	uint64_t hash = 0, element, element2;
+
+#define REF_ROR(a, n) ((((a) >> (n)) | ((a) << (width - (n)))) & mask)
+	while (count > 0) {
+		const size_t len = (count < bytes) ? count : bytes;
+
+		element = 0;
+		for (size_t i = 0; i < len; i++) element |= (uint64_t)data[i] << (i * 8);
+		element2 = REF_ROR(element, shift) ^ REF_ROR(constant, shift2);
+		element = (element + constant) & mask;
+		hash = (hash + element) & mask;
+		hash ^= element2;
+		hash = REF_ROR(hash, width - shift2);
+		hash = (hash + ((len == bytes) ? element : element2)) & mask;
+		data += len;
+		count -= len;
+	}
+#undef REF_ROR
+	return hash;
+}
+
+static void check(const char *what, size_t len, size_t offset, uint64_t got, uint64_t expected)
+{
+	if (got == expected) return;
+	fprintf(stderr, "FAILED: %s len %zu offset %zu: got %016" PRIx64 " expected %016" PRIx64 "\n",
+			what, len, offset, got, expected);
+	failures++;
+}
+
+/* Every length at every alignment must match the reference */
+static void test_block_hash(const unsigned char *buf)
+{
+	jodyhash_t hash;
+
+	for (size_t offset = 0; offset < MAXOFFSET; offset++) {
+		for (size_t len = 0; len <= TESTSIZE - MAXOFFSET - sizeof(jodyhash_t); len++) {
+			hash = 0;
+			if (jody_block_hash((jodyhash_t *)(uintptr_t)(buf + offset), &hash, len) != 0) {
+				fprintf(stderr, "FAILED: jody_block_hash returned an error\n");
+				failures++;
+				return;
+			}
+			check("jody_block_hash", len, offset, hash, ref_hash(buf + offset, 0, len));
+		}
+	}
+	return;
+}
+
+/* jody_block_hash64/32/16() whatever the width of this build */
+static void test_block_hash_widths(const unsigned char *buf)
+{
+	uint64_t hash64;
+	uint32_t hash32;
+	uint16_t hash16;
+
+	for (size_t offset = 0; offset < MAXOFFSET; offset += 3) {
+		for (size_t len = 0; len <= TESTSIZE - MAXOFFSET - sizeof(uint64_t); len++) {
+			hash64 = 0;
+			hash32 = 0;
+			hash16 = 0;
+			if (jody_block_hash64((uint64_t *)(uintptr_t)(buf + offset), &hash64, len) != 0
+					|| jody_block_hash32((uint32_t *)(uintptr_t)(buf + offset), &hash32, len) != 0
+					|| jody_block_hash16((uint16_t *)(uintptr_t)(buf + offset), &hash16, len) != 0) {
+				fprintf(stderr, "FAILED: jody_block_hash64/32/16 returned an error\n");
+				failures++;
+				return;
+			}
+			check("jody_block_hash64", len, offset, hash64, ref_hash_width(buf + offset, len, 64));
+			check("jody_block_hash32", len, offset, hash32, ref_hash_width(buf + offset, len, 32));
+			check("jody_block_hash16", len, offset, hash16, ref_hash_width(buf + offset, len, 16));
+		}
+	}
+	return;
+}
+
+/* Same for jodyhash-wide, starting from a non-zero hash */
+static void test_block_hash_wide(const unsigned char *buf)
+{
+	jodyhash_t hash;
+
+	for (size_t offset = 0; offset < MAXOFFSET; offset++) {
+		for (size_t len = 0; len <= TESTSIZE - MAXOFFSET - sizeof(jodyhash_t); len++) {
+			hash = (jodyhash_t)JODY_HASH_CONSTANT;
+			if (jody_block_hash_wide((jodyhash_t *)(uintptr_t)(buf + offset), &hash, len) != 0) {
+				fprintf(stderr, "FAILED: jody_block_hash_wide returned an error\n");
+				failures++;
+				return;
+			}
+			check("jody_block_hash_wide", len, offset, hash,
+					ref_hash_wide(buf + offset, (jodyhash_t)JODY_HASH_CONSTANT, len));
+		}
+	}
+	return;
+}
+
+#if JODY_HASH_WIDTH == 64
+/* Both halves of jodyhash128, starting from non-zero values */
+static void test_block_hash128(const unsigned char *buf)
+{
+	jodyhash128_t hash;
+	const jodyhash_t lo = (jodyhash_t)JODY_HASH_CONSTANT, hi = (jodyhash_t)JODY_HASH128_CONSTANT;
+
+	for (size_t offset = 0; offset < MAXOFFSET; offset++) {
+		for (size_t len = 0; len <= TESTSIZE - MAXOFFSET - sizeof(jodyhash_t); len++) {
+			hash.lo = lo;
+			hash.hi = hi;
+			if (jody_block_hash128((jodyhash_t *)(uintptr_t)(buf + offset), &hash, len) != 0) {
+				fprintf(stderr, "FAILED: jody_block_hash128 returned an error\n");
+				failures++;
+				return;
+			}
+			check("jody_block_hash128 (low)", len, offset, hash.lo, ref_hash(buf + offset, lo, len));
+			check("jody_block_hash128 (high)", len, offset, hash.hi, ref_hash128_hi(buf + offset, hi, len));
+		}
+	}
+	return;
+}
+#endif /* JODY_HASH_WIDTH == 64 */
+
+#if !defined _WIN32 && defined JH_TAIL_IN_BOUNDS
+/* Blocks that end right before an inaccessible page must not fault,
+ * whatever kernel hashes them */
+static void test_block_hash_bounds(const unsigned char *buf)
+{
+	jodyhash_t hash;
+#if JODY_HASH_WIDTH == 64
+	jodyhash128_t hash128;
+#endif
+
+	if (guard_end == NULL) return;
+	memcpy(guard_end - TESTSIZE, buf, TESTSIZE);
+	for (size_t len = 0; len <= TESTSIZE; len++) {
+		unsigned char *data = guard_end - len;
+
+		hash = 0;
+		jody_block_hash((jodyhash_t *)(uintptr_t)data, &hash, len);
+		check("jody_block_hash at page end", len, 0, hash, ref_hash(data, 0, len));
+		hash = 0;
+		jody_block_hash_wide((jodyhash_t *)(uintptr_t)data, &hash, len);
+		check("jody_block_hash_wide at page end", len, 0, hash, ref_hash_wide(data, 0, len));
+#if JODY_HASH_WIDTH == 64
+		hash128.lo = 0;
+		hash128.hi = 0;
+		jody_block_hash128((jodyhash_t *)(uintptr_t)data, &hash128, len);
+		check("jody_block_hash128 at page end (low)", len, 0, hash128.lo, ref_hash(data, 0, len));
+		check("jody_block_hash128 at page end (high)", len, 0, hash128.hi, ref_hash128_hi(data, 0, len));
+#endif
+	}
+	return;
+}
+#endif
+
+/* C strings and text lines of every length at every alignment; the
+ * high bit keeps NUL, CR and LF out of the test strings */
+static void test_str_hash(const unsigned char *buf)
+{
+	static char str[TESTSIZE + 8];
+	jodyhash_t hash, expected;
+	size_t len, got_len;
+
+	for (size_t offset = 0; offset < 16; offset++) {
+		for (len = 0; len <= TESTSIZE - 16; len++) {
+			for (size_t i = 0; i < len; i++) str[offset + i] = (char)(buf[i] | 0x80);
+			str[offset + len] = '\0';
+			hash = (jodyhash_t)JODY_HASH_CONSTANT;
+			got_len = SIZE_MAX;
+			if (jody_str_hash(str + offset, &hash, &got_len) != 0) {
+				fprintf(stderr, "FAILED: jody_str_hash returned an error\n");
+				failures++;
+				return;
+			}
+			expected = ref_hash((const unsigned char *)str + offset, (jodyhash_t)JODY_HASH_CONSTANT, len);
+			check("jody_str_hash", len, offset, hash, expected);
+			check("jody_str_hash length", len, offset, (jodyhash_t)got_len, (jodyhash_t)len);
+
+			/* The same string as a line with "\n" and "\r\n" endings */
+			for (int crlf = 0; crlf < 2 && len + 2 < TESTSIZE - 16; crlf++) {
+				if (crlf) str[offset + len] = '\r';
+				str[offset + len + (size_t)crlf] = '\n';
+				str[offset + len + (size_t)crlf + 1] = '\0';
+				hash = (jodyhash_t)JODY_HASH_CONSTANT;
+				got_len = SIZE_MAX;
+				jody_line_hash(str + offset, &hash, &got_len);
+				check("jody_line_hash", len, offset, hash, expected);
+				check("jody_line_hash length", len, offset, (jodyhash_t)got_len, (jodyhash_t)len);
+			}
+		}
+	}
+
+#ifndef _WIN32
+	/* Strings that end right before an inaccessible page must not fault */
+	if (guard_end != NULL) {
+		char *end = (char *)guard_end;
+
+		memset(end - guard_size, 'x', guard_size);
+		end[-1] = '\0';
+		for (len = 0; len < 200; len++) {
+			hash = 0;
+			jody_str_hash(end - 1 - len, &hash, &got_len);
+			check("jody_str_hash at page end", len, 0, hash, ref_hash((const unsigned char *)end - 1 - len, 0, len));
+		}
+	}
+#endif /* _WIN32 */
+	return;
+}
+
+/* Streaming in pieces of every size up to a few words, and in ragged
+ * pieces, must match hashing everything at once */
+static void test_stream(const unsigned char *buf)
+{
+	jodyhash_state state;
+	jodyhash_t hash;
+	uint32_t seed = 7;
+	size_t done, piece;
+
+	for (size_t len = 0; len <= TESTSIZE; len += 1 + len / 8) {
+		for (size_t step = 0; step <= 3 * sizeof(jodyhash_t) + 1; step++) {
+			jody_hash_init(&state);
+			for (done = 0; done < len; done += piece) {
+				if (step > 0) piece = step;
+				else {
+					/* Random pieces, including empty ones */
+					seed = seed * 1103515245U + 12345U;
+					piece = (seed >> 16) % 37;
+				}
+				if (piece > len - done) piece = len - done;
+				if (jody_hash_update(&state, buf + done, piece) != 0) {
+					fprintf(stderr, "FAILED: jody_hash_update returned an error\n");
+					failures++;
+					return;
+				}
+			}
+			hash = 1;
+			jody_hash_final(&state, &hash);
+			check("jody_hash_update", len, step, hash, ref_hash(buf, 0, len));
+		}
+	}
+	return;
+}
+
+/* jodyhash-wide in pieces must match one jody_block_hash_wide() call,
+ * with pieces both smaller and bigger than a stripe */
+static void test_stream_wide(const unsigned char *buf)
+{
+	jodyhash_wide_state state;
+	jodyhash_t hash, whole;
+	uint32_t seed = 5;
+	size_t done, piece;
+
+	for (size_t len = 0; len <= TESTSIZE; len += 1 + len / 8) {
+		for (size_t step = 0; step <= 2 * JODY_HASH_WIDE_STRIPE + 1; step += 1 + step / 4) {
+			jody_hash_wide_init(&state);
+			state.hash = (jodyhash_t)JODY_HASH_CONSTANT;
+			for (done = 0; done < len; done += piece) {
+				if (step > 0) piece = step;
+				else {
+					/* Random pieces, including empty ones */
+					seed = seed * 1103515245U + 12345U;
+					piece = (seed >> 16) % 151;
+				}
+				if (piece > len - done) piece = len - done;
+				if (jody_hash_wide_update(&state, buf + done, piece) != 0) {
+					fprintf(stderr, "FAILED: jody_hash_wide_update returned an error\n");
+					failures++;
+					return;
+				}
+			}
+			jody_hash_wide_final(&state, &hash);
+			whole = (jodyhash_t)JODY_HASH_CONSTANT;
+			jody_block_hash_wide((jodyhash_t *)(uintptr_t)buf, &whole, len);
+			check("jody_hash_wide_update", len, step, hash, whole);
+		}
+	}
+	return;
+}
+
+#ifndef _WIN32
+/* Blocks cut up into iovecs of ragged sizes (some empty, some unaligned)
+ * must match the whole block, starting from a non-zero hash */
+#define MAXIOV 64
+static void test_block_hash_iov(const unsigned char *buf)
+{
+	struct iovec iov[MAXIOV];
+	jodyhash_t hash;
+	uint32_t seed = 11;
+	size_t done, piece;
+	int cnt;
+
+	for (size_t len = 0; len <= TESTSIZE; len += 1 + len / 4) {
+		for (int round = 0; round < 8; round++) {
+			for (done = 0, cnt = 0; done < len; done += piece, cnt++) {
+				seed = seed * 1103515245U + 12345U;
+				piece = (cnt == MAXIOV - 1) ? len - done : (seed >> 16) % (1 + len / 4);
+				if (piece > len - done) piece = len - done;
+				iov[cnt].iov_base = (void *)(uintptr_t)(buf + done);
+				iov[cnt].iov_len = piece;
+			}
+			hash = (jodyhash_t)JODY_HASH_CONSTANT;
+			if (jody_block_hash_iov(iov, cnt, &hash) != 0) {
+				fprintf(stderr, "FAILED: jody_block_hash_iov returned an error\n");
+				failures++;
+				return;
+			}
+			check("jody_block_hash_iov", len, (size_t)cnt, hash, ref_hash(buf, (jodyhash_t)JODY_HASH_CONSTANT, len));
+		}
+	}
+	return;
+}
+#endif /* _WIN32 */
+
+/* The inline small-key path, up to a bit past where it hands off; keys
+ * that end right before an inaccessible page must not fault */
+static void test_block_hash_small(const unsigned char *buf)
+{
+	jodyhash_t hash;
+
+	for (size_t offset = 0; offset < MAXOFFSET; offset++) {
+		for (size_t len = 0; len <= JODY_HASH_SMALL_MAX * 2; len++) {
+			hash = (jodyhash_t)JODY_HASH_CONSTANT;
+			jody_block_hash_small(buf + offset, &hash, len);
+			check("jody_block_hash_small", len, offset, hash, ref_hash(buf + offset, (jodyhash_t)JODY_HASH_CONSTANT, len));
+		}
+	}
+
+#if !defined _WIN32 && defined JH_TAIL_IN_BOUNDS
+	if (guard_end != NULL) {
+		memcpy(guard_end - JODY_HASH_SMALL_MAX, buf, JODY_HASH_SMALL_MAX);
+		for (size_t len = 0; len <= JODY_HASH_SMALL_MAX; len++) {
+			hash = 0;
+			jody_block_hash_small(guard_end - len, &hash, len);
+			check("jody_block_hash_small at page end", len, 0, hash, ref_hash(guard_end - len, 0, len));
+		}
+	}
+#endif
+	return;
+}
+
+/* Batches of ragged keys must match hashing each key on its own; the
+ * starting values are non-zero to catch lanes that get reset or mixed up */
+#define MULTIKEYS 37
+static void test_block_hash_multi(const unsigned char *buf)
+{
+	const void *bufs[MULTIKEYS];
+	size_t lens[MULTIKEYS];
+	jodyhash_t out[MULTIKEYS], expected[MULTIKEYS];
+	uint32_t seed = 0x9e3779b9;
+
+	for (int round = 0; round < 2000; round++) {
+		const size_t n = (size_t)round % (MULTIKEYS + 1);
+
+		for (size_t i = 0; i < n; i++) {
+			seed = seed * 1103515245U + 12345U;
+			/* Mostly short keys with the odd long one */
+			lens[i] = (seed >> 8) % ((seed & 0x80000000U) ? 200 : 24);
+			bufs[i] = buf + ((seed >> 4) % MAXOFFSET);
+			out[i] = (jodyhash_t)(seed * JODY_HASH_CONSTANT);
+			expected[i] = ref_hash(bufs[i], out[i], lens[i]);
+		}
+		if (jody_block_hash_multi(bufs, lens, out, n) != 0) {
+			fprintf(stderr, "FAILED: jody_block_hash_multi returned an error\n");
+			failures++;
+			return;
+		}
+		for (size_t i = 0; i < n; i++)
+			check("jody_block_hash_multi", lens[i], (size_t)((const unsigned char *)bufs[i] - buf), out[i], expected[i]);
+	}
+	return;
+}
+
+/* jody_block_hash_k(): out[0] must be the seeded hash, a smaller k must
+ * give the start of a bigger k's values, and every length must work */
+static void test_block_hash_k(const unsigned char *buf)
+{
+	jodyhash_t out[KMAX], out2[KMAX], hash;
+
+	for (size_t len = 0; len <= TESTSIZE; len += 1 + len / 8) {
+		for (uint64_t seed = 0; seed < 3; seed++) {
+			if (jody_block_hash_k(buf, len, seed, out, KMAX) != 0
+					|| jody_block_hash_k(buf, len, seed, out2, 3) != 0
+					|| jody_block_hash_seeded(buf, len, seed, &hash) != 0) {
+				fprintf(stderr, "FAILED: jody_block_hash_k returned an error\n");
+				failures++;
+				return;
+			}
+			check("jody_block_hash_k out[0]", len, (size_t)seed, out[0], hash);
+			for (size_t i = 0; i < 3; i++) check("jody_block_hash_k with k = 3", len, i, out2[i], out[i]);
+		}
+	}
+	return;
+}
+
+/* Tree hashing spelled out level by level, with reference leaf hashes */
+static jodyhash_t ref_tree_hash(const unsigned char *data, size_t count, size_t leafsize)
+{
+	static jodyhash_t nodes[TESTSIZE + 1];
+	size_t n = 0, next;
+
+	for (size_t off = 0; off < count || n == 0; off += leafsize)
+		nodes[n++] = ref_hash(data + off, 0, (count - off < leafsize) ? count - off : leafsize);
+	while (n > 1) {
+		for (next = 0; next < n / 2; next++)
+			nodes[next] = ref_hash((const unsigned char *)&nodes[next * 2], (jodyhash_t)JODY_HASH_CONSTANT, sizeof(jodyhash_t) * 2);
+		if (n & 1) nodes[next++] = nodes[n - 1];
+		n = next;
+	}
+	return nodes[0];
+}
+
+/* jody_tree_hash() with and without threads, against the reference */
+static void test_tree_hash(const unsigned char *buf)
+{
+	static const size_t leafsizes[] = { sizeof(jodyhash_t), 64, 200 };
+	jodyhash_t root;
+
+	for (size_t l = 0; l < sizeof(leafsizes) / sizeof(leafsizes[0]); l++) {
+		for (size_t len = 0; len <= TESTSIZE; len += 1 + len / 8) {
+			for (unsigned int threads = 1; threads <= 4; threads += 3) {
+				if (jody_tree_hash(buf, len, leafsizes[l], threads, &root) != 0) {
+					fprintf(stderr, "FAILED: jody_tree_hash returned an error\n");
+					failures++;
+					return;
+				}
+				check("jody_tree_hash", len, leafsizes[l], root, ref_tree_hash(buf, len, leafsizes[l]));
+			}
+		}
+	}
+	if (jody_tree_hash(buf, TESTSIZE, sizeof(jodyhash_t) + 1, 1, &root) == 0) {
+		fprintf(stderr, "FAILED: jody_tree_hash took a leaf size that isn't whole words\n");
+		failures++;
+	}
+	return;
+}
+
+/* Rolling hashes big enough to be split between threads, with block
+ * sizes that do and don't divide the runs the work is split into */
+#define ROLLSIZE (3 * 1048576 + 1234)
+static void test_rolling_hash(void)
+{
+	static const size_t blocksizes[] = { 1, 100, JODY_ROLLING_BLOCKSIZE, 65536 * 3 };
+	static const size_t lens[] = { 0, 1, 4097, ROLLSIZE };
+	unsigned char *data;
+	jodyhash_t hash, want;
+	size_t block;
+	uint32_t seed = 0x13579bdf;
+
+	data = (unsigned char *)malloc(ROLLSIZE);
+	if (data == NULL) {
+		fprintf(stderr, "FAILED: out of memory for the rolling hash test\n");
+		failures++;
+		return;
+	}
+	for (size_t i = 0; i < ROLLSIZE; i++) {
+		seed = seed * 1103515245U + 12345U;
+		data[i] = (unsigned char)(seed >> 16);
+	}
+	for (size_t b = 0; b < sizeof(blocksizes) / sizeof(blocksizes[0]); b++) {
+		for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+			/* Tiny blocks of all of the data take too long the slow way */
+			if (blocksizes[b] == 1 && lens[l] == ROLLSIZE) continue;
+			want = 0;
+			for (size_t off = 0; off < lens[l]; off += blocksizes[b]) {
+				block = (lens[l] - off < blocksizes[b]) ? lens[l] - off : blocksizes[b];
+				want ^= ref_hash(data + off, 0, block);
+			}
+			for (unsigned int threads = 1; threads <= 4; threads += 3) {
+				hash = 0;
+				if (jody_rolling_hash(data, lens[l], blocksizes[b], threads, &hash) != 0) {
+					fprintf(stderr, "FAILED: jody_rolling_hash returned an error\n");
+					failures++;
+					free(data);
+					return;
+				}
+				check("jody_rolling_hash", lens[l], blocksizes[b], hash, want);
+			}
+			if (blocksizes[b] == JODY_ROLLING_BLOCKSIZE) {
+				hash = 0;
+				jody_rolling_block_hash((jodyhash_t *)(uintptr_t)data, &hash, lens[l]);
+				check("jody_rolling_block_hash", lens[l], 0, hash, want);
+			}
+		}
+	}
+	free(data);
+	return;
+}
+
+/* Asynchronous hashing: short jobs that get batched and longer ones,
+ * all of which must come back once with the right hash */
+#define ASYNCJOBS 3000
+struct async_result {
+	jodyhash_t hash;
+	int calls;
+	int error;
+};
+
+static void async_done(void *ctx, const jodyhash_t hash, const int error)
+{
+	struct async_result *r = (struct async_result *)ctx;
+
+	r->hash = hash;
+	r->error = error;
+	r->calls++;
+	/* Waiting from a callback must not hang the worker */
+	jody_hash_wait();
+	return;
+}
+
+static void test_async(const unsigned char *buf)
+{
+	static struct async_result results[ASYNCJOBS];
+	size_t off, len;
+
+	for (size_t i = 0; i < ASYNCJOBS; i++) {
+		off = (i * 7) % 64;
+		len = (i % 10 == 0) ? TESTSIZE - off : (i * 13) % 300;
+		if (jody_hash_submit(buf + off, len, async_done, &results[i]) != 0) {
+			fprintf(stderr, "FAILED: jody_hash_submit returned an error\n");
+			failures++;
+			jody_hash_wait();
+			return;
+		}
+	}
+	jody_hash_wait();
+	if (jody_hash_pending() != 0) {
+		fprintf(stderr, "FAILED: jody_hash_pending is %zu after jody_hash_wait\n", jody_hash_pending());
+		failures++;
+	}
+	for (size_t i = 0; i < ASYNCJOBS; i++) {
+		off = (i * 7) % 64;
+		len = (i % 10 == 0) ? TESTSIZE - off : (i * 13) % 300;
+		if (results[i].calls != 1 || results[i].error != 0) {
+			fprintf(stderr, "FAILED: jody_hash_submit job %zu called back %d times, error %d\n",
+					i, results[i].calls, results[i].error);
+			failures++;
+			return;
+		}
+		check("jody_hash_submit", len, off, results[i].hash, ref_hash(buf + off, 0, len));
+	}
+	return;
+}
+
+/* Gear hash of the window that ends at p[i], spelled out */
+static uint32_t ref_gear_hash(const unsigned char *p, const size_t i)
+{
+	uint32_t h = 0, g;
+
+	for (size_t k = 0; k < JODY_CDC_WINDOW; k++) {
+		g = p[i - k] + 0x8748ee5dU;
+		g ^= g >> 16; g *= 0x85ebca6bU;
+		g ^= g >> 13; g *= 0xc2b2ae35U;
+		g ^= g >> 16;
+		h += g << k;
+	}
+	return h;
+}
+
+/* Content-defined chunking the slow way; returns the number of chunks */
+static size_t ref_cdc(const unsigned char *data, const size_t count, const size_t min,
+		const size_t avg, const size_t max, jody_chunk_t *chunks)
+{
+	unsigned int bits = 0;
+	uint32_t mask_s, mask_l;
+	size_t n = 0, len;
+
+	while ((avg >> (bits + 1)) != 0) bits++;
+	mask_s = ~0U << (30 - bits);
+	mask_l = ~0U << (34 - bits);
+	for (size_t off = 0; off < count; off += len, n++) {
+		if (count - off <= min) len = count - off;
+		else for (len = min; len < max && off + len < count; len++)
+			if ((ref_gear_hash(data + off, len - 1) & ((len < avg) ? mask_s : mask_l)) == 0) break;
+		chunks[n].offset = off;
+		chunks[n].length = len;
+		chunks[n].hash = ref_hash(data + off, 0, len);
+	}
+	return n;
+}
+
+static int same_chunks(const jody_chunk_t *a, const jody_chunk_t *b, const size_t n)
+{
+	for (size_t i = 0; i < n; i++)
+		if (a[i].offset != b[i].offset || a[i].length != b[i].length || a[i].hash != b[i].hash) return 0;
+	return 1;
+}
+
+/* jody_cdc_chunks() against the reference, fed all at once and a piece
+ * at a time, and cut points coming back after an insertion */
+static void test_cdc(void)
+{
+	static const size_t sizes[][3] = { { 64, 256, 1024 }, { 100, 700, 2000 }, { 2048, 8192, 65536 } };
+	static unsigned char data[CDCSIZE + 1];
+	static jody_chunk_t ref[CDCMAXCHUNKS], got[CDCMAXCHUNKS];
+	jody_cdc_t cdc;
+	size_t nref, n, c, used, start, avail, shared;
+	uint32_t seed = 0x9abcdef0;
+
+	/* Random data with a run of zeroes, which has no cut points */
+	for (size_t i = 0; i < CDCSIZE; i++) {
+		seed = seed * 1103515245U + 12345U;
+		data[i] = (unsigned char)(seed >> 16);
+	}
+	memset(data + CDCSIZE / 2, 0, CDCZEROES);
+
+	for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		if (jody_cdc_init(&cdc, sizes[s][0], sizes[s][1], sizes[s][2]) != 0) {
+			fprintf(stderr, "FAILED: jody_cdc_init rejected %zu/%zu/%zu\n", sizes[s][0], sizes[s][1], sizes[s][2]);
+			failures++;
+			return;
+		}
+		nref = ref_cdc(data, CDCSIZE, sizes[s][0], sizes[s][1], sizes[s][2], ref);
+		n = jody_cdc_chunks(&cdc, data, CDCSIZE, 1, got, CDCMAXCHUNKS, &used);
+		if (n != nref || used != CDCSIZE || !same_chunks(got, ref, n)) {
+			fprintf(stderr, "FAILED: jody_cdc_chunks avg %zu: %zu chunks, %zu expected\n", sizes[s][1], n, nref);
+			failures++;
+		}
+
+		/* Pieces that end anywhere, final only at the very end */
+		n = 0;
+		for (start = 0, avail = 0; start < CDCSIZE; start += used) {
+			avail += 1 + (avail * 7) % 1999;
+			if (start + avail > CDCSIZE) avail = CDCSIZE - start;
+			c = jody_cdc_chunks(&cdc, data + start, avail, start + avail == CDCSIZE, got + n, CDCMAXCHUNKS - n, &used);
+			for (; c > 0; c--, n++) got[n].offset += start;
+			avail -= used;
+		}
+		if (n != nref || !same_chunks(got, ref, n)) {
+			fprintf(stderr, "FAILED: jody_cdc_chunks avg %zu fed in pieces\n", sizes[s][1]);
+			failures++;
+		}
+	}
+
+	/* One byte inserted at a third of the way in only changes the chunks
+	 * around it; jody_cdc_next() must agree with jody_cdc_chunks() */
+	jody_cdc_init(&cdc, 64, 256, 1024);
+	nref = jody_cdc_chunks(&cdc, data, CDCSIZE, 1, ref, CDCMAXCHUNKS, &used);
+	memmove(data + CDCSIZE / 3 + 1, data + CDCSIZE / 3, CDCSIZE - CDCSIZE / 3);
+	data[CDCSIZE / 3] = 0x55;
+	n = jody_cdc_chunks(&cdc, data, CDCSIZE + 1, 1, got, CDCMAXCHUNKS, &used);
+	shared = 0;
+	for (size_t i = 0; i < nref; i++)
+		for (size_t j = 0; j < n; j++)
+			if (ref[i].hash == got[j].hash && ref[i].length == got[j].length) {
+				shared++;
+				break;
+			}
+	if (shared + 3 < nref) {
+		fprintf(stderr, "FAILED: only %zu of %zu chunks survived a one byte insertion\n", shared, nref);
+		failures++;
+	}
+	start = 0;
+	for (size_t i = 0; i < n; i++) {
+		if (jody_cdc_next(&cdc, data + start, CDCSIZE + 1 - start, 1) != got[i].length) {
+			fprintf(stderr, "FAILED: jody_cdc_next disagrees with jody_cdc_chunks at %zu\n", start);
+			failures++;
+			break;
+		}
+		start += got[i].length;
+	}
+	used = jody_cdc_next(&cdc, data, 1000, 0);
+	if (used != 0 && used != got[0].length) {
+		fprintf(stderr, "FAILED: jody_cdc_next cut a chunk it couldn't see the end of\n");
+		failures++;
+	}
+
+	if (jody_cdc_init(&cdc, 32, 256, 1024) == 0 || jody_cdc_init(&cdc, 256, 256, 1024) == 0
+			|| jody_cdc_init(&cdc, 64, 2048, 1024) == 0) {
+		fprintf(stderr, "FAILED: jody_cdc_init took bad sizes\n");
+		failures++;
+	}
+	return;
+}
+
+/* Rebuilds the new data from the old data and jody_delta()'s output */
+struct delta_rebuild {
+	const unsigned char *old;
+	const unsigned char *new;
+	unsigned char *out;
+	size_t base;
+	size_t len;
+	size_t copied;
+	size_t blocksize;
+	int bad;
+};
+
+static int delta_rebuild(void *arg, const size_t offset, const size_t length, const size_t block)
+{
+	struct delta_rebuild *r = (struct delta_rebuild *)arg;
+
+	if (r->base + offset != r->len || r->len + length > DELTASIZE * 2) {
+		r->bad = 1;
+		return 1;
+	}
+	if (block == JODY_DELTA_LITERAL) memcpy(r->out + r->len, r->new + r->len, length);
+	else {
+		memcpy(r->out + r->len, r->old + block * r->blocksize, length);
+		r->copied += length;
+	}
+	r->len += length;
+	return 0;
+}
+
+/* Deltas of edited data against the signature of the original, which
+ * must rebuild the edited data and copy most of it, whether the data is
+ * passed all at once or a piece at a time */
+static void test_delta(void)
+{
+	static const size_t blocksizes[] = { 64, 100, 1024 };
+	static unsigned char old[DELTASIZE], new[DELTASIZE * 2], out[DELTASIZE * 2];
+	static jody_block_sig_t sigs[DELTAMAXBLOCKS];
+	jody_delta_index_t index;
+	struct delta_rebuild r;
+	size_t newsize, used, start, avail;
+	uint32_t seed = 0x2468ace1;
+
+	for (size_t i = 0; i < DELTASIZE; i++) {
+		seed = seed * 1103515245U + 12345U;
+		old[i] = (unsigned char)(seed >> 16);
+	}
+	/* A byte inserted, 5000 bytes deleted, a piece moved forward and
+	 * 3000 new bytes at the end */
+	newsize = 0;
+	memcpy(new, old, 1000); newsize += 1000;
+	new[newsize++] = 0x42;
+	memcpy(new + newsize, old + 1000, 9000); newsize += 9000;
+	memcpy(new + newsize, old + 40000, 20000); newsize += 20000;
+	memcpy(new + newsize, old + 15000, 25000); newsize += 25000;
+	memcpy(new + newsize, old + 60000, DELTASIZE - 60000); newsize += DELTASIZE - 60000;
+	for (size_t i = 0; i < 3000; i++) {
+		seed = seed * 1103515245U + 12345U;
+		new[newsize++] = (unsigned char)(seed >> 16);
+	}
+
+	for (size_t s = 0; s < sizeof(blocksizes) / sizeof(blocksizes[0]); s++) {
+		const size_t bs = blocksizes[s];
+
+		if (jody_block_signature(old, DELTASIZE, bs, sigs) != 0
+				|| jody_delta_index(&index, sigs, JODY_DELTA_BLOCKS(DELTASIZE, bs), bs, DELTASIZE) != 0) {
+			fprintf(stderr, "FAILED: jody_block_signature/jody_delta_index returned an error\n");
+			failures++;
+			return;
+		}
+		if (sigs[1].weak != jody_weak_sum(old + bs, bs) || sigs[1].strong != ref_hash(old + bs, 0, bs)) {
+			fprintf(stderr, "FAILED: jody_block_signature block size %zu\n", bs);
+			failures++;
+		}
+		for (int pieces = 0; pieces < 2; pieces++) {
+			memset(&r, 0, sizeof(r));
+			r.old = old; r.new = new; r.out = out; r.blocksize = bs;
+			for (start = 0, avail = pieces ? 777 : newsize; start < newsize; start += used, r.base = start) {
+				if (start + avail > newsize) avail = newsize - start;
+				if (jody_delta(&index, new + start, avail, start + avail == newsize, delta_rebuild, &r, &used) != 0) break;
+				avail = avail - used + (pieces ? 777 : 0);
+			}
+			if (r.bad || r.len != newsize || memcmp(out, new, newsize) != 0) {
+				fprintf(stderr, "FAILED: jody_delta block size %zu%s doesn't rebuild the data\n", bs, pieces ? " in pieces" : "");
+				failures++;
+			} else if (r.copied + 3000 + 8 * bs < newsize) {
+				fprintf(stderr, "FAILED: jody_delta block size %zu%s only copied %zu of %zu bytes\n",
+						bs, pieces ? " in pieces" : "", r.copied, newsize);
+				failures++;
+			}
+		}
+		jody_delta_index_free(&index);
+	}
+	if (jody_delta_index(&index, sigs, 3, 1024, DELTASIZE) == 0) {
+		fprintf(stderr, "FAILED: jody_delta_index took the wrong number of blocks\n");
+		failures++;
+		jody_delta_index_free(&index);
+	}
+	return;
+}
+
+/* The keys for the distribution tests: counters, which differ from each
+ * other in only a few bits (the hardest case for a weakly mixed hash) */
+static void make_key(unsigned char *key, uint64_t n)
+{
+	for (size_t i = 0; i < KEYSIZE; i++, n >>= 8) key[i] = (unsigned char)n;
+	return;
+}
+
+/* Flipping any bit of the seed should flip about half the hash bits */
+static void test_seed_avalanche(void)
+{
+	unsigned char key[KEYSIZE];
+	jodyhash_t hash, flipped, diff;
+	uint64_t changed = 0, total = 0;
+	double ratio;
+
+	for (uint64_t n = 0; n < 256; n++) {
+		make_key(key, n);
+		jody_block_hash_seeded(key, KEYSIZE, 0, &hash);
+		for (unsigned int bit = 0; bit < 64; bit++) {
+			jody_block_hash_seeded(key, KEYSIZE, (uint64_t)1 << bit, &flipped);
+			for (diff = hash ^ flipped; diff != 0; diff &= (jodyhash_t)(diff - 1)) changed++;
+			total += JODY_HASH_WIDTH;
+		}
+	}
+	ratio = (double)changed / (double)total;
+	if (ratio < 0.49 || ratio > 0.51) {
+		fprintf(stderr, "FAILED: seed avalanche: %.4f of the bits change\n", ratio);
+		failures++;
+	}
+	return;
+}
+
+/* Each pair of derived values must be independent: bucket both of them
+ * (mod a prime, like a Bloom filter of that size would) and chi-square
+ * test the table of bucket pairs. With 16 keys per cell on average the
+ * statistic is about (BUCKETS - 1)^2 give or take 85; allow six times
+ * that much over. */
+static void test_hash_k_independence(void)
+{
+	static jodyhash_t values[BUCKETS * BUCKETS * 16][KDIST];
+	static unsigned int table[BUCKETS][BUCKETS];
+	const size_t keys = BUCKETS * BUCKETS * 16;
+	const double expected = 16.0;
+	const double df = (BUCKETS - 1) * (BUCKETS - 1);
+	unsigned char key[KEYSIZE];
+	double chi2;
+
+	for (size_t n = 0; n < keys; n++) {
+		make_key(key, n);
+		jody_block_hash_k(key, KEYSIZE, 42, values[n], KDIST);
+	}
+	for (unsigned int a = 0; a < KDIST; a++) {
+		for (unsigned int b = a + 1; b < KDIST; b++) {
+			memset(table, 0, sizeof(table));
+			for (size_t n = 0; n < keys; n++) table[values[n][a] % BUCKETS][values[n][b] % BUCKETS]++;
+			chi2 = 0;
+			for (unsigned int i = 0; i < BUCKETS; i++) {
+				for (unsigned int j = 0; j < BUCKETS; j++) {
+					const double d = (double)table[i][j] - expected;
+
+					chi2 += d * d / expected;
+				}
+			}
+			if (chi2 > df + 6 * 85) {
+				fprintf(stderr, "FAILED: hashes %u and %u of jody_block_hash_k are not independent (chi-square %.0f, expected about %.0f)\n",
+						a, b, chi2, df);
+				failures++;
+			}
+		}
+	}
+	return;
+}
+
+/* What it is all for: a Bloom filter sized for a 0.9% false positive
+ * rate with independent hashes must not do much worse than that */
+static void test_hash_k_bloom(void)
+{
+	static unsigned char bits[BLOOM_BITS / 8];
+	unsigned char key[KEYSIZE];
+	jodyhash_t out[BLOOM_K];
+	unsigned int hit, false_positives = 0;
+
+	memset(bits, 0, sizeof(bits));
+	for (uint64_t n = 0; n < BLOOM_KEYS; n++) {
+		make_key(key, n);
+		jody_block_hash_k(key, KEYSIZE, 7, out, BLOOM_K);
+		for (unsigned int i = 0; i < BLOOM_K; i++)
+			bits[(out[i] % BLOOM_BITS) / 8] |= (unsigned char)(1U << (out[i] % 8));
+	}
+	for (uint64_t n = BLOOM_KEYS; n < BLOOM_KEYS * 2; n++) {
+		make_key(key, n);
+		jody_block_hash_k(key, KEYSIZE, 7, out, BLOOM_K);
+		hit = 1;
+		for (unsigned int i = 0; i < BLOOM_K; i++)
+			if (!(bits[(out[i] % BLOOM_BITS) / 8] & (1U << (out[i] % 8)))) hit = 0;
+		false_positives += hit;
+	}
+	if (false_positives > BLOOM_KEYS * 15 / 1000) {
+		fprintf(stderr, "FAILED: Bloom filter with jody_block_hash_k: %u false positives in %u (expected about %u)\n",
+				false_positives, BLOOM_KEYS, BLOOM_KEYS * 9 / 1000);
+		failures++;
+	}
+	return;
+}
+
+#ifndef _WIN32
+static void setup_guard_page(void)
+{
+	const long pagesize = sysconf(_SC_PAGESIZE);
+	unsigned char *pages = (unsigned char *)mmap(NULL, (size_t)pagesize * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (pages == MAP_FAILED || mprotect(pages + pagesize, (size_t)pagesize, PROT_NONE) != 0) {
+		fprintf(stderr, "FAILED: cannot set up a guard page\n");
+		failures++;
+		return;
+	}
+	guard_size = (size_t)pagesize;
+	guard_end = pages + pagesize;
+	return;
+}
+#endif /* _WIN32 */
+
+int main(void)
+{
+	static jodyhash_t storage[TESTSIZE / sizeof(jodyhash_t)];
+	unsigned char *buf = (unsigned char *)storage;
+	uint32_t seed = 0x12345678;
+
+	/* Fill the test buffer with deterministic pseudo-random bytes */
+	for (size_t i = 0; i < TESTSIZE; i++) {
+		seed = seed * 1103515245U + 12345U;
+		buf[i] = (unsigned char)(seed >> 16);
+	}
+
+	/* 'make test' asks for every kernel; skip the ones that aren't here */
+	if (getenv("JODY_HASH_KERNEL") != NULL && strcmp(getenv("JODY_HASH_KERNEL"), jody_hash_kernel(NULL)) != 0) {
+		printf("selftest: kernel %s is not available, skipped\n", getenv("JODY_HASH_KERNEL"));
+		return SELFTEST_SKIPPED;
+	}
+
+#ifndef _WIN32
+	setup_guard_page();
+#endif
+	test_block_hash(buf);
+	test_block_hash_wide(buf);
+	test_block_hash_widths(buf);
+#if JODY_HASH_WIDTH == 64
+	test_block_hash128(buf);
+#endif
+	test_block_hash_multi(buf);
+	test_block_hash_small(buf);
+	test_stream(buf);
+	test_stream_wide(buf);
+#ifndef _WIN32
+	test_block_hash_iov(buf);
+#endif
+#if !defined _WIN32 && defined JH_TAIL_IN_BOUNDS
+	test_block_hash_bounds(buf);
+#endif
+	test_str_hash(buf);
+	test_tree_hash(buf);
+	test_rolling_hash();
+	test_async(buf);
+	test_cdc();
+	test_delta();
+	test_block_hash_k(buf);
+	test_seed_avalanche();
+	test_hash_k_independence();
+	test_hash_k_bloom();
+
+	if (failures) {
+		fprintf(stderr, "selftest: %d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("selftest: all tests passed\n");
+	return EXIT_SUCCESS;
+}
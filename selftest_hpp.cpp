@@ -0,0 +1,131 @@
+/* jodyhash C++ header self-test: hashes worked out at compile time must
+ * match the C library at run time
+ *
+ * Copyright (C) 2014-2023 by Jody Bruchon <jody@jodybruchon.com>
+ * Released under The MIT License
+ */
+
+#include <algorithm>
+#include <array>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include "jody_hash.hpp"
+
+using namespace jody::literals;
+
+#define TESTSIZE 300
+
+/* Deterministic pseudo-random bytes, made by the compiler */
+static constexpr std::array<char, TESTSIZE> make_data()
+{
+	std::array<char, TESTSIZE> data{};
+	std::uint32_t seed = 0x12345678;
+
+	for (auto &c : data) {
+		seed = seed * 1103515245U + 12345U;
+		c = (char)(seed >> 16);
+	}
+	return data;
+}
+static constexpr std::array<char, TESTSIZE> data = make_data();
+
+/* The hash of every prefix of the data, made by the compiler */
+static constexpr std::array<jodyhash_t, TESTSIZE + 1> make_hashes()
+{
+	std::array<jodyhash_t, TESTSIZE + 1> hashes{};
+
+	for (std::size_t len = 0; len <= TESTSIZE; len++)
+		hashes[len] = jody::hash::of(std::string_view(data.data(), len));
+	return hashes;
+}
+static constexpr std::array<jodyhash_t, TESTSIZE + 1> hashes = make_hashes();
+
+/* String literals work as switch cases */
+static int route(std::string_view name)
+{
+	switch (jody::hash::of(name)) {
+	case "GET /"_jh: return 1;
+	case "GET /index.html"_jh: return 2;
+	case "POST /upload"_jh: return 3;
+	default: return 0;
+	}
+}
+
+/* The hashed string types and the transparent hasher must agree with
+ * jody::hash and with each other */
+static int test_hashed_strings()
+{
+	static constexpr jody::hashed_string_view key("jodyhash");
+	static_assert(key.jodyhash() == "jodyhash"_jh);
+	const std::string str("The quick brown fox jumps over the lazy dog");
+	const jody::hashed_string hstr(str);
+	const jody::string_hash hasher;
+	const jody::string_equal equal;
+	std::unordered_map<jody::hashed_string, int, jody::string_hash, jody::string_equal> map;
+	int failures = 0;
+
+	if (hasher(str) != jody::hash::of(str) || hasher(hstr) != hasher(str)
+			|| hasher(std::string_view(str)) != hasher(str) || hasher(str.c_str()) != hasher(str)
+			|| hasher(jody::hashed_string_view(hstr)) != hasher(str) || hasher(key) != "jodyhash"_jh) {
+		fprintf(stderr, "FAILED: string_hash\n");
+		failures++;
+	}
+	if (!equal(hstr, str) || !equal(str.c_str(), hstr) || equal(hstr, key)
+			|| !equal(jody::hashed_string_view(hstr), hstr) || hstr != jody::hashed_string(str)) {
+		fprintf(stderr, "FAILED: string_equal\n");
+		failures++;
+	}
+
+	map.emplace(key, 1);
+	map.emplace(str, 2);
+	if (map.find(jody::hashed_string("jodyhash")) == map.end() || map.find(hstr)->second != 2) {
+		fprintf(stderr, "FAILED: hashed_string map lookup\n");
+		failures++;
+	}
+#ifdef __cpp_lib_generic_unordered_lookup
+	/* Lookups without making a hashed_string */
+	if (map.find(std::string_view("jodyhash")) == map.end() || map.find(key)->second != 1
+			|| map.find(str.c_str())->second != 2 || map.find("jodyhas") != map.end()) {
+		fprintf(stderr, "FAILED: heterogeneous map lookup\n");
+		failures++;
+	}
+#endif
+	return failures;
+}
+
+int main()
+{
+	static jodyhash_t storage[(TESTSIZE + sizeof(jodyhash_t)) / sizeof(jodyhash_t)];
+	int failures = 0;
+
+	std::copy(data.begin(), data.end(), (char *)storage);
+	for (std::size_t len = 0; len <= TESTSIZE; len++) {
+		jodyhash_t c_hash = 0, cpp_hash;
+
+		jody_block_hash(storage, &c_hash, len);
+		/* Not constant-evaluated, so this goes to the C library */
+		cpp_hash = jody::hash::of(std::string_view((const char *)storage, len));
+		if (hashes[len] != c_hash || cpp_hash != c_hash) {
+			fprintf(stderr, "FAILED: len %zu: compile time %016" PRIx64 ", run time %016" PRIx64 ", C %016" PRIx64 "\n",
+					len, (uint64_t)hashes[len], (uint64_t)cpp_hash, (uint64_t)c_hash);
+			failures++;
+		}
+	}
+	if (route("GET /index.html") != 2 || route("POST /upload") != 3 || route("PUT /") != 0) {
+		fprintf(stderr, "FAILED: switch on _jh literals\n");
+		failures++;
+	}
+
+	failures += test_hashed_strings();
+
+	if (failures) {
+		fprintf(stderr, "selftest_hpp: %d failures\n", failures);
+		return EXIT_FAILURE;
+	}
+	printf("selftest_hpp: all tests passed\n");
+	return EXIT_SUCCESS;
+}
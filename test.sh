@@ -10,11 +10,60 @@ TF1="$TESTDIR/$FILE1"
 TF2="$TESTDIR/$FILE2"
 GF1="$TESTDIR/hash_$FILE1"
 GF2="$TESTDIR/hash_$FILE2"
+GW1="$TESTDIR/hash_wide_$FILE1"
+GW2="$TESTDIR/hash_wide_$FILE2"
+G1281="$TESTDIR/hash128_$FILE1"
+G1282="$TESTDIR/hash128_$FILE2"
+G321="$TESTDIR/hash32_$FILE1"
+G322="$TESTDIR/hash32_$FILE2"
+G161="$TESTDIR/hash16_$FILE1"
+G162="$TESTDIR/hash16_$FILE2"
+GT1="$TESTDIR/hashtree_$FILE1"
+GT2="$TESTDIR/hashtree_$FILE2"
+GC1="$TESTDIR/hashcdc_$FILE1"
+GC2="$TESTDIR/hashcdc_$FILE2"
+GS1="$TESTDIR/hashsig_$FILE1"
+GS2="$TESTDIR/hashsig_$FILE2"
+GR1="$TESTDIR/hashroll_$FILE1"
+GR2="$TESTDIR/hashroll_$FILE2"
 
 GOOD1=$(cat "$GF1")
 GOOD2=$(cat "$GF2")
 HASH1=$($JODYHASH "$TF1")
 HASH2=$($JODYHASH "$TF2")
+GOODW1=$(cat "$GW1")
+GOODW2=$(cat "$GW2")
+HASHW1=$($JODYHASH -W "$TF1")
+HASHW2=$($JODYHASH -W "$TF2")
+GOOD1281=$(cat "$G1281")
+GOOD1282=$(cat "$G1282")
+HASH1281=$($JODYHASH -w 128 "$TF1")
+HASH1282=$($JODYHASH -w 128 "$TF2")
+GOOD321=$(cat "$G321")
+GOOD322=$(cat "$G322")
+HASH321=$($JODYHASH -w 32 "$TF1")
+HASH322=$($JODYHASH -w 32 "$TF2")
+GOOD161=$(cat "$G161")
+GOOD162=$(cat "$G162")
+HASH161=$($JODYHASH -w 16 "$TF1")
+HASH162=$($JODYHASH -w 16 "$TF2")
+GOODT1=$(cat "$GT1")
+GOODT2=$(cat "$GT2")
+HASHT1=$($JODYHASH -T 64K "$TF1")
+HASHT2=$($JODYHASH -T 64K "$TF2")
+# The chunk list is long, so it's checked by its hash
+GOODC1=$(cat "$GC1")
+GOODC2=$(cat "$GC2")
+HASHC1=$($JODYHASH -C 8K "$TF1" | $JODYHASH)
+HASHC2=$($JODYHASH -C 8K "$TF2" | $JODYHASH)
+GOODS1=$(cat "$GS1")
+GOODS2=$(cat "$GS2")
+HASHS1=$($JODYHASH -S 4K "$TF1" | $JODYHASH)
+HASHS2=$($JODYHASH -S 4K "$TF2" | $JODYHASH)
+GOODR1=$(cat "$GR1")
+GOODR2=$(cat "$GR2")
+HASHR1=$($JODYHASH -r "$TF1")
+HASHR2=$($JODYHASH -R 4K "$TF2")
 
 ERR=0
 
@@ -22,8 +71,76 @@ ERR=0
 [ -z "$GOOD2" ] && echo "ERROR: Read hash from '$GF2' FAILED" && exit 126
 [ -z "$HASH1" ] && echo "ERROR: Hashing file '$TF1' FAILED" && exit 125
 [ -z "$HASH2" ] && echo "ERROR: Hashing file '$TF2' FAILED" && exit 124
+[ -z "$GOODW1" ] && echo "ERROR: Read hash from '$GW1' FAILED" && exit 123
+[ -z "$GOODW2" ] && echo "ERROR: Read hash from '$GW2' FAILED" && exit 122
+[ -z "$HASHW1" ] && echo "ERROR: Hashing file '$TF1' (wide) FAILED" && exit 121
+[ -z "$HASHW2" ] && echo "ERROR: Hashing file '$TF2' (wide) FAILED" && exit 120
+[ -z "$GOOD1281" ] && echo "ERROR: Read hash from '$G1281' FAILED" && exit 119
+[ -z "$GOOD1282" ] && echo "ERROR: Read hash from '$G1282' FAILED" && exit 118
+[ -z "$HASH1281" ] && echo "ERROR: Hashing file '$TF1' (128-bit) FAILED" && exit 117
+[ -z "$HASH1282" ] && echo "ERROR: Hashing file '$TF2' (128-bit) FAILED" && exit 116
+[ -z "$GOOD321" ] && echo "ERROR: Read hash from '$G321' FAILED" && exit 115
+[ -z "$GOOD322" ] && echo "ERROR: Read hash from '$G322' FAILED" && exit 114
+[ -z "$HASH321" ] && echo "ERROR: Hashing file '$TF1' (32-bit) FAILED" && exit 113
+[ -z "$HASH322" ] && echo "ERROR: Hashing file '$TF2' (32-bit) FAILED" && exit 112
+[ -z "$GOOD161" ] && echo "ERROR: Read hash from '$G161' FAILED" && exit 111
+[ -z "$GOOD162" ] && echo "ERROR: Read hash from '$G162' FAILED" && exit 110
+[ -z "$HASH161" ] && echo "ERROR: Hashing file '$TF1' (16-bit) FAILED" && exit 109
+[ -z "$HASH162" ] && echo "ERROR: Hashing file '$TF2' (16-bit) FAILED" && exit 108
+[ -z "$GOODT1" ] && echo "ERROR: Read hash from '$GT1' FAILED" && exit 107
+[ -z "$GOODT2" ] && echo "ERROR: Read hash from '$GT2' FAILED" && exit 106
+[ -z "$HASHT1" ] && echo "ERROR: Hashing file '$TF1' (tree) FAILED" && exit 105
+[ -z "$HASHT2" ] && echo "ERROR: Hashing file '$TF2' (tree) FAILED" && exit 104
+[ -z "$GOODC1" ] && echo "ERROR: Read hash from '$GC1' FAILED" && exit 102
+[ -z "$GOODC2" ] && echo "ERROR: Read hash from '$GC2' FAILED" && exit 101
+[ -z "$GOODS1" ] && echo "ERROR: Read hash from '$GS1' FAILED" && exit 100
+[ -z "$GOODS2" ] && echo "ERROR: Read hash from '$GS2' FAILED" && exit 99
+[ -z "$GOODR1" ] && echo "ERROR: Read hash from '$GR1' FAILED" && exit 97
+[ -z "$GOODR2" ] && echo "ERROR: Read hash from '$GR2' FAILED" && exit 96
 
 if [ "$HASH1" != "$GOOD1" ]; then echo "Hash FAILED: $TF1"; ERR=1; else echo "Hash PASSED: $TF1"; fi
 if [ "$HASH2" != "$GOOD2" ]; then echo "Hash FAILED: $TF2"; ERR=2; else echo "Hash PASSED: $TF2"; fi
+if [ "$HASHW1" != "$GOODW1" ]; then echo "Wide hash FAILED: $TF1"; ERR=3; else echo "Wide hash PASSED: $TF1"; fi
+if [ "$HASHW2" != "$GOODW2" ]; then echo "Wide hash FAILED: $TF2"; ERR=4; else echo "Wide hash PASSED: $TF2"; fi
+if [ "$HASH1281" != "$GOOD1281" ]; then echo "128-bit hash FAILED: $TF1"; ERR=5; else echo "128-bit hash PASSED: $TF1"; fi
+if [ "$HASH1282" != "$GOOD1282" ]; then echo "128-bit hash FAILED: $TF2"; ERR=6; else echo "128-bit hash PASSED: $TF2"; fi
+if [ "$HASH321" != "$GOOD321" ]; then echo "32-bit hash FAILED: $TF1"; ERR=7; else echo "32-bit hash PASSED: $TF1"; fi
+if [ "$HASH322" != "$GOOD322" ]; then echo "32-bit hash FAILED: $TF2"; ERR=8; else echo "32-bit hash PASSED: $TF2"; fi
+if [ "$HASH161" != "$GOOD161" ]; then echo "16-bit hash FAILED: $TF1"; ERR=9; else echo "16-bit hash PASSED: $TF1"; fi
+if [ "$HASH162" != "$GOOD162" ]; then echo "16-bit hash FAILED: $TF2"; ERR=10; else echo "16-bit hash PASSED: $TF2"; fi
+if [ "$HASHT1" != "$GOODT1" ]; then echo "Tree hash FAILED: $TF1"; ERR=11; else echo "Tree hash PASSED: $TF1"; fi
+if [ "$HASHT2" != "$GOODT2" ]; then echo "Tree hash FAILED: $TF2"; ERR=12; else echo "Tree hash PASSED: $TF2"; fi
+if [ "$HASHC1" != "$GOODC1" ]; then echo "Chunking FAILED: $TF1"; ERR=14; else echo "Chunking PASSED: $TF1"; fi
+if [ "$HASHC2" != "$GOODC2" ]; then echo "Chunking FAILED: $TF2"; ERR=15; else echo "Chunking PASSED: $TF2"; fi
+if [ "$HASHS1" != "$GOODS1" ]; then echo "Signature FAILED: $TF1"; ERR=16; else echo "Signature PASSED: $TF1"; fi
+if [ "$HASHS2" != "$GOODS2" ]; then echo "Signature FAILED: $TF2"; ERR=17; else echo "Signature PASSED: $TF2"; fi
+if [ "$HASHR1" != "$GOODR1" ]; then echo "Rolling hash FAILED: $TF1"; ERR=19; else echo "Rolling hash PASSED: $TF1"; fi
+if [ "$HASHR2" != "$GOODR2" ]; then echo "Rolling hash FAILED: $TF2"; ERR=20; else echo "Rolling hash PASSED: $TF2"; fi
+
+# Updating a saved tree after a change must give the same root as
+# hashing the changed file from scratch
+TMP=$(mktemp -d) || exit 103
+cp "$TF1" "$TMP/file"
+OLDU=$($JODYHASH -T 4K -D "$TMP/tree" "$TMP/file")
+printf 'X' | dd of="$TMP/file" bs=1 seek=100000 conv=notrunc 2>/dev/null
+HASHU=$($JODYHASH -U "$TMP/tree" "$TMP/file" 100000+1 2>/dev/null)
+GOODU=$($JODYHASH -T 4K "$TMP/file")
+rm -rf "$TMP"
+if [ -z "$HASHU" ] || [ "$HASHU" != "$GOODU" ] || [ "$HASHU" = "$OLDU" ]; then echo "Tree update FAILED: $TF1"; ERR=13; else echo "Tree update PASSED: $TF1"; fi
+
+# The delta of a file with a byte inserted against the old signature must
+# rebuild the new file from old blocks and the literals
+TMP=$(mktemp -d) || exit 98
+$JODYHASH -S 4K "$TF1" > "$TMP/sig"
+{ head -c 100000 "$TF1"; printf 'X'; tail -c +100001 "$TF1"; } > "$TMP/new"
+$JODYHASH -M "$TMP/sig" "$TMP/new" 2>/dev/null | while read -r OP OFF LEN OLD; do
+	case "$OP" in
+		copy) tail -c +$((OLD + 1)) "$TF1" | head -c "$LEN" ;;
+		literal) tail -c +$((OFF + 1)) "$TMP/new" | head -c "$LEN" ;;
+	esac
+done > "$TMP/rebuilt"
+LINES=$($JODYHASH -M "$TMP/sig" "$TMP/new" 2>/dev/null | wc -l)
+if ! cmp -s "$TMP/new" "$TMP/rebuilt" || [ "$LINES" -gt 3 ]; then echo "Delta FAILED: $TF1"; ERR=18; else echo "Delta PASSED: $TF1"; fi
+rm -rf "$TMP"
 
 exit $ERR
@@ -46,45 +46,627 @@
 #endif
 
 #if JODY_HASH_WIDTH == 64
-#define PRINTHASH(a) printf("%016" PRIx64,a)
+#define HASHFMT "%016" PRIx64
+#define HASHSCN "%" SCNx64
 #endif
 #if JODY_HASH_WIDTH == 32
-#define PRINTHASH(a) printf("%08" PRIx32,a)
+#define HASHFMT "%08" PRIx32
+#define HASHSCN "%" SCNx32
 #endif
 #if JODY_HASH_WIDTH == 16
-#define PRINTHASH(a) printf("%04" PRIx16,a)
+#define HASHFMT "%04" PRIx16
+#define HASHSCN "%" SCNx16
 #endif
+#define PRINTHASH(a) printf(HASHFMT,a)
 
 #ifndef BSIZE
 #define BSIZE 32768
 #endif
 
+/* Tree hashing reads this much at a time (rounded down to whole leaves)
+ * so there are enough leaves to keep all of the threads busy */
+#ifndef TREE_CHUNK
+#define TREE_CHUNK 67108864
+#endif
+
 static int error = EXIT_SUCCESS;
 static char *progname;
+static int (*hashfunc)(jodyhash_t *, jodyhash_t *, const size_t) = jody_block_hash;
+
+/* The running hash; jodyhash128 (-w 128) keeps its own. Plain jodyhash
+ * and jodyhash-wide stream whole files through 'state' and 'wide_state'
+ * so reads of any size work. */
+static jodyhash_t hash;
+static jodyhash_state state;
+static jodyhash_wide_state wide_state;
+static int streamed = 0;
+#if JODY_HASH_WIDTH == 64
+static jodyhash128_t hash128;
+static int use128 = 0;
+#endif
+/* -w 64/32/16 hashes with a width other than the one this is built for */
+static int width = JODY_HASH_WIDTH;
+static uint64_t hash64;
+static uint32_t hash32;
+static uint16_t hash16;
+/* jodyhash128 and the other widths have no streaming state of their own:
+ * whole words are hashed as they come in and the bytes of a partial word
+ * wait here for the next read, so short reads (from a pipe, say) don't
+ * change the hash. 8 bytes is a whole number of words at every width. */
+static uint64_t carry;
+static size_t carry_len;
+/* -T: tree hash with leaves of this size; -D also writes the tree to a
+ * file, which -U reads back to rehash only the leaves that changed */
+static size_t tree_leafsize = 0;
+static const char *tree_dump = NULL;
+static const char *tree_update = NULL;
+/* -C: content-defined chunks of a file, one line per chunk */
+static jody_cdc_t cdc;
+static int use_cdc = 0;
+/* -S: block signature of a file for rsync-style deltas; -M: the delta
+ * of a file against a signature as copy and literal instructions */
+static size_t sig_blocksize = 0;
+static const char *delta_sig = NULL;
+/* -r/-R: rolling hash over blocks of this size */
+static size_t roll_blocksize = 0;
+
+static void hash_reset(void)
+{
+	hash = 0;
+	jody_hash_init(&state);
+	jody_hash_wide_init(&wide_state);
+	streamed = 0;
+#if JODY_HASH_WIDTH == 64
+	hash128.lo = 0;
+	hash128.hi = 0;
+#endif
+	hash64 = 0;
+	hash32 = 0;
+	hash16 = 0;
+	carry_len = 0;
+	return;
+}
+
+/* Hash with jodyhash128 or another width, whatever 'count' is */
+static int hash_words(void *data, const size_t count)
+{
+#if JODY_HASH_WIDTH == 64
+	if (use128) return jody_block_hash128((jodyhash_t *)data, &hash128, count);
+#endif
+	if (width == 64) return jody_block_hash64((uint64_t *)data, &hash64, count);
+	if (width == 32) return jody_block_hash32((uint32_t *)data, &hash32, count);
+	return jody_block_hash16((uint16_t *)data, &hash16, count);
+}
+
+/* Feed hash_words() whole words only, keeping the rest in 'carry' */
+static int hash_carry(const unsigned char *data, size_t count)
+{
+	size_t n;
+
+	if (carry_len > 0) {
+		n = sizeof(carry) - carry_len;
+		if (n > count) n = count;
+		memcpy((unsigned char *)&carry + carry_len, data, n);
+		carry_len += n;
+		data += n;
+		count -= n;
+		if (carry_len < sizeof(carry)) return 0;
+		if (hash_words(&carry, sizeof(carry)) != 0) return 1;
+		carry_len = 0;
+	}
+	n = count & ~(sizeof(carry) - 1);
+	if (n > 0 && hash_words((void *)(uintptr_t)data, n) != 0) return 1;
+	if (count > n) {
+		memcpy(&carry, data + n, count - n);
+		carry_len = count - n;
+	}
+	return 0;
+}
+
+static int hash_block(jodyhash_t *data, const size_t count)
+{
+#if JODY_HASH_WIDTH == 64
+	if (use128) return hash_carry((const unsigned char *)data, count);
+#endif
+	if (width != JODY_HASH_WIDTH) return hash_carry((const unsigned char *)data, count);
+	streamed = 1;
+	if (hashfunc == jody_block_hash_wide) return jody_hash_wide_update(&wide_state, data, count);
+	return jody_hash_update(&state, data, count);
+}
+
+/* Hash a line from fgets() without its line ending and return its
+ * length; plain jodyhash can find the end while it hashes */
+static int hash_line(char *line, size_t *len)
+{
+#if JODY_HASH_WIDTH == 64
+	if (!use128 && width == JODY_HASH_WIDTH && hashfunc == jody_block_hash) return jody_line_hash(line, &hash, len);
+#else
+	if (width == JODY_HASH_WIDTH && hashfunc == jody_block_hash) return jody_line_hash(line, &hash, len);
+#endif
+	*len = strlen(line);
+	if (*len > 0 && line[*len - 1] == '\n') {
+		(*len)--;
+		if (*len > 0 && line[*len - 1] == '\r') (*len)--;
+	}
+	return hash_block((jodyhash_t *)(void *)line, *len);
+}
+
+/* jodyhash128 prints the high half first; the low 64 bits are the
+ * same as the normal jodyhash */
+static void hash_print(void)
+{
+	if (carry_len > 0) {
+		hash_words(&carry, carry_len);
+		carry_len = 0;
+	}
+#if JODY_HASH_WIDTH == 64
+	if (use128) {
+		printf("%016" PRIx64 "%016" PRIx64, hash128.hi, hash128.lo);
+		return;
+	}
+#endif
+	if (width == 64 && width != JODY_HASH_WIDTH) printf("%016" PRIx64, hash64);
+	else if (width == 32 && width != JODY_HASH_WIDTH) printf("%08" PRIx32, hash32);
+	else if (width == 16 && width != JODY_HASH_WIDTH) printf("%04" PRIx16, hash16);
+	if (width != JODY_HASH_WIDTH) return;
+	if (streamed) {
+		if (hashfunc == jody_block_hash_wide) jody_hash_wide_final(&wide_state, &hash);
+		else jody_hash_final(&state, &hash);
+	}
+	PRINTHASH(hash);
+	return;
+}
+
+/* A size in bytes with an optional K, M or G (binary) suffix; 0 if bad */
+static uint64_t parse_size(const char *s, char **end)
+{
+	uint64_t size;
+	char *p;
+
+	if (*s < '0' || *s > '9') return 0;
+	size = strtoull(s, &p, 10);
+	if (*p == 'K' || *p == 'k') { size <<= 10; p++; }
+	else if (*p == 'M' || *p == 'm') { size <<= 20; p++; }
+	else if (*p == 'G' || *p == 'g') { size <<= 30; p++; }
+	if (end != NULL) *end = p;
+	else if (*p != '\0') return 0;
+	return size;
+}
+
+/* Hash all of the leaves of a file a chunk at a time; *leaves is
+ * allocated here and *n and *size are set to the leaf count and size */
+static int tree_hash_file(FILE *fp, jodyhash_t **leaves, size_t *n, uint64_t *size)
+{
+	const size_t chunk = (tree_leafsize < TREE_CHUNK) ? TREE_CHUNK - (TREE_CHUNK % tree_leafsize) : tree_leafsize;
+	unsigned char *buf;
+	jodyhash_t *grow;
+	size_t got, room = 0, count;
+
+	*leaves = NULL;
+	*n = 0;
+	*size = 0;
+	buf = (unsigned char *)malloc(chunk);
+	if (buf == NULL) return 1;
+	do {
+		got = fread(buf, 1, chunk, fp);
+		if (ferror(fp)) goto error;
+		if (got == 0 && *size > 0) break;
+		count = JODY_TREE_LEAVES(got, tree_leafsize);
+		if (*n + count > room) {
+			room = (*n + count) * 2;
+			grow = (jodyhash_t *)realloc(*leaves, room * sizeof(jodyhash_t));
+			if (grow == NULL) goto error;
+			*leaves = grow;
+		}
+		if (jody_tree_leaves(buf, got, tree_leafsize, 0, *leaves + *n) != 0) goto error;
+		*n += count;
+		*size += got;
+	} while (got == chunk);
+	free(buf);
+	return 0;
+
+error:
+	free(buf);
+	free(*leaves);
+	*leaves = NULL;
+	return 1;
+}
+
+/* Tree dump: a header line, then one leaf hash per line */
+static int tree_write(const char *path, const jodyhash_t *leaves, const size_t n, const uint64_t size)
+{
+	FILE *fp = fopen(path, "w");
+
+	if (fp == NULL) return 1;
+	fprintf(fp, "jodyhash tree %d %d %zu %" PRIu64 "\n", JODY_TREE_VERSION, JODY_HASH_WIDTH, tree_leafsize, size);
+	for (size_t i = 0; i < n; i++) fprintf(fp, HASHFMT "\n", leaves[i]);
+	if (ferror(fp)) {
+		fclose(fp);
+		return 1;
+	}
+	return fclose(fp) != 0;
+}
+
+/* Read a tree dump; sets tree_leafsize from it */
+static int tree_read(const char *path, jodyhash_t **leaves, size_t *n, uint64_t *size)
+{
+	FILE *fp = fopen(path, "r");
+	int version, bits;
+
+	*leaves = NULL;
+	if (fp == NULL) return 1;
+	if (fscanf(fp, "jodyhash tree %d %d %zu %" SCNu64, &version, &bits, &tree_leafsize, size) != 4
+			|| version != JODY_TREE_VERSION || bits != JODY_HASH_WIDTH
+			|| tree_leafsize == 0 || (tree_leafsize & (sizeof(jodyhash_t) - 1)) != 0) goto error;
+	*n = JODY_TREE_LEAVES(*size, tree_leafsize);
+	*leaves = (jodyhash_t *)malloc(*n * sizeof(jodyhash_t));
+	if (*leaves == NULL) goto error;
+	for (size_t i = 0; i < *n; i++)
+		if (fscanf(fp, " " HASHSCN, &(*leaves)[i]) != 1) goto error;
+	fclose(fp);
+	return 0;
+
+error:
+	free(*leaves);
+	*leaves = NULL;
+	fclose(fp);
+	return 1;
+}
+
+/* -U: rehash the leaves of a file that overlap the byte ranges given as
+ * offset+length (and any leaves past the old end if the size changed),
+ * write the tree back out and put the new root in 'hash' */
+static int tree_update_file(FILE *fp, char **ranges, const int nranges)
+{
+	jodyhash_t *leaves = NULL, *grow;
+	unsigned char *changed = NULL, *buf = NULL;
+	size_t n, newn, len, rehashed = 0;
+	uint64_t size, newsize, offset, length;
+	char *p;
+	off_t end;
+
+	if (tree_read(tree_update, &leaves, &n, &size) != 0) {
+		fprintf(stderr, "error: cannot read tree: %s\n", tree_update);
+		return 1;
+	}
+	if (fseeko(fp, 0, SEEK_END) != 0 || (end = ftello(fp)) < 0) goto error;
+	newsize = (uint64_t)end;
+	newn = JODY_TREE_LEAVES(newsize, tree_leafsize);
+	grow = (jodyhash_t *)realloc(leaves, newn * sizeof(jodyhash_t));
+	changed = (unsigned char *)calloc(newn, 1);
+	buf = (unsigned char *)malloc(tree_leafsize);
+	if (grow == NULL || changed == NULL || buf == NULL) goto error;
+	leaves = grow;
+
+	for (int i = 0; i < nranges; i++) {
+		offset = parse_size(ranges[i], &p);
+		if (*p != '+' || (length = parse_size(p + 1, NULL)) == 0) {
+			fprintf(stderr, "error: bad range '%s' (should be offset+length)\n", ranges[i]);
+			goto error;
+		}
+		for (uint64_t leaf = offset / tree_leafsize; leaf < newn && leaf * tree_leafsize < offset + length; leaf++)
+			changed[leaf] = 1;
+	}
+	if (newsize != size)
+		for (size_t leaf = (size_t)(((newsize < size) ? newsize : size) / tree_leafsize); leaf < newn; leaf++)
+			changed[leaf] = 1;
+
+	for (size_t leaf = 0; leaf < newn; leaf++) {
+		if (!changed[leaf]) continue;
+		len = (newsize - (uint64_t)leaf * tree_leafsize < tree_leafsize) ? (size_t)(newsize - (uint64_t)leaf * tree_leafsize) : tree_leafsize;
+		if (fseeko(fp, (off_t)leaf * (off_t)tree_leafsize, SEEK_SET) != 0 || fread(buf, 1, len, fp) != len) goto error;
+		if (jody_tree_leaves(buf, len, tree_leafsize, 1, &leaves[leaf]) != 0) goto error;
+		rehashed++;
+	}
+	if (jody_tree_root(leaves, newn, &hash) != 0 || tree_write(tree_update, leaves, newn, newsize) != 0) goto error;
+	fprintf(stderr, "rehashed %zu of %zu leaves\n", rehashed, newn);
+	free(leaves); free(changed); free(buf);
+	return 0;
+
+error:
+	free(leaves); free(changed); free(buf);
+	return 1;
+}
+
+/* -T/-U: tree hash a file into 'hash'; ranges are for -U */
+static int tree_hash(FILE *fp, char **ranges, const int nranges)
+{
+	jodyhash_t *leaves;
+	size_t n;
+	uint64_t size;
+	int ret;
+
+	if (tree_update != NULL) return tree_update_file(fp, ranges, nranges);
+	if (tree_hash_file(fp, &leaves, &n, &size) != 0) return 1;
+	ret = jody_tree_root(leaves, n, &hash);
+	if (ret == 0 && tree_dump != NULL && tree_write(tree_dump, leaves, n, size) != 0) {
+		fprintf(stderr, "error: cannot write tree: %s\n", tree_dump);
+		ret = 1;
+	}
+	free(leaves);
+	return ret;
+}
+
+/* -r/-R: rolling hash of a file into 'hash', a big multiple of the block
+ * size at a time so that all CPUs get some of each read */
+static int roll_file(FILE *fp)
+{
+	const size_t chunk = (roll_blocksize < TREE_CHUNK) ? TREE_CHUNK - (TREE_CHUNK % roll_blocksize) : roll_blocksize;
+	unsigned char *buf;
+	size_t got;
+
+	buf = (unsigned char *)malloc(chunk);
+	if (buf == NULL) return 1;
+	do {
+		got = fread(buf, 1, chunk, fp);
+		if (ferror(fp) || jody_rolling_hash(buf, got, roll_blocksize, 0, &hash) != 0) {
+			free(buf);
+			return 1;
+		}
+	} while (got == chunk);
+	free(buf);
+	return 0;
+}
+
+/* -C: print the offset, length and hash of each chunk of a file */
+static int cdc_file(FILE *fp)
+{
+	/* Room for several maximum size chunks so reads aren't too small */
+	const size_t bufsize = (cdc.max_size < (1U << 20)) ? (1U << 22) : cdc.max_size * 4;
+	jody_chunk_t chunks[256];
+	unsigned char *buf;
+	size_t filled = 0, got, n, used;
+	uint64_t base = 0;
+	int eof = 0;
+
+	buf = (unsigned char *)malloc(bufsize);
+	if (buf == NULL) return 1;
+	while (!eof || filled > 0) {
+		if (!eof) {
+			got = fread(buf + filled, 1, bufsize - filled, fp);
+			if (ferror(fp)) goto error;
+			filled += got;
+			if (feof(fp)) eof = 1;
+		}
+		do {
+			n = jody_cdc_chunks(&cdc, buf, filled, eof, chunks, sizeof(chunks) / sizeof(jody_chunk_t), &used);
+			for (size_t c = 0; c < n; c++)
+				printf("%" PRIu64 " %zu " HASHFMT "\n", base + chunks[c].offset, chunks[c].length, chunks[c].hash);
+			memmove(buf, buf + used, filled - used);
+			filled -= used;
+			base += used;
+		} while (n == sizeof(chunks) / sizeof(jody_chunk_t));
+	}
+	free(buf);
+	return 0;
+
+error:
+	free(buf);
+	return 1;
+}
+
+/* -S: read a whole file a chunk at a time and print its signature: a
+ * header line, then the weak sum and hash of each block, one per line */
+static int sig_file(FILE *fp)
+{
+	const size_t chunk = (sig_blocksize < TREE_CHUNK) ? TREE_CHUNK - (TREE_CHUNK % sig_blocksize) : sig_blocksize;
+	jody_block_sig_t *sigs = NULL, *grow;
+	unsigned char *buf;
+	size_t got, n = 0, room = 0, count;
+	uint64_t size = 0;
+
+	buf = (unsigned char *)malloc(chunk);
+	if (buf == NULL) return 1;
+	do {
+		got = fread(buf, 1, chunk, fp);
+		if (ferror(fp)) goto error;
+		count = JODY_DELTA_BLOCKS(got, sig_blocksize);
+		if (n + count > room) {
+			room = (n + count) * 2;
+			grow = (jody_block_sig_t *)realloc(sigs, room * sizeof(jody_block_sig_t));
+			if (grow == NULL) goto error;
+			sigs = grow;
+		}
+		if (jody_block_signature(buf, got, sig_blocksize, sigs + n) != 0) goto error;
+		n += count;
+		size += got;
+	} while (got == chunk);
+	printf("jodyhash signature %d %d %zu %" PRIu64 "\n", JODY_DELTA_VERSION, JODY_HASH_WIDTH, sig_blocksize, size);
+	for (size_t i = 0; i < n; i++) printf("%08" PRIx32 " " HASHFMT "\n", sigs[i].weak, sigs[i].strong);
+	free(buf); free(sigs);
+	return 0;
+
+error:
+	free(buf); free(sigs);
+	return 1;
+}
+
+/* Read a signature written by -S; sets sig_blocksize from it */
+static int sig_read(const char *path, jody_block_sig_t **sigs, size_t *n, uint64_t *size)
+{
+	FILE *fp = fopen(path, "r");
+	int version, bits;
+
+	*sigs = NULL;
+	if (fp == NULL) return 1;
+	if (fscanf(fp, "jodyhash signature %d %d %zu %" SCNu64, &version, &bits, &sig_blocksize, size) != 4
+			|| version != JODY_DELTA_VERSION || bits != JODY_HASH_WIDTH || sig_blocksize == 0) goto error;
+	*n = (size_t)JODY_DELTA_BLOCKS(*size, sig_blocksize);
+	*sigs = (jody_block_sig_t *)malloc((*n + 1) * sizeof(jody_block_sig_t));
+	if (*sigs == NULL) goto error;
+	for (size_t i = 0; i < *n; i++)
+		if (fscanf(fp, " %" SCNx32 " " HASHSCN, &(*sigs)[i].weak, &(*sigs)[i].strong) != 2) goto error;
+	fclose(fp);
+	return 0;
+
+error:
+	free(*sigs);
+	*sigs = NULL;
+	fclose(fp);
+	return 1;
+}
+
+/* -M output: runs of copies of consecutive old blocks and literal runs
+ * that jody_delta() hands over in pieces are put back together */
+struct delta_out {
+	uint64_t base;
+	size_t blocksize;
+	size_t block;
+	uint64_t offset;
+	uint64_t length;
+	uint64_t copied;
+};
+
+static void delta_flush(struct delta_out *out)
+{
+	if (out->length == 0) return;
+	if (out->block == JODY_DELTA_LITERAL) printf("literal %" PRIu64 " %" PRIu64 "\n", out->offset, out->length);
+	else printf("copy %" PRIu64 " %" PRIu64 " %" PRIu64 "\n", out->offset, out->length, (uint64_t)out->block * out->blocksize);
+	out->length = 0;
+	return;
+}
+
+static int delta_emit(void *arg, const size_t offset, const size_t length, const size_t block)
+{
+	struct delta_out *out = (struct delta_out *)arg;
+	const size_t blocks = (size_t)(out->length / out->blocksize);
+
+	if (block != JODY_DELTA_LITERAL) out->copied += length;
+	if (out->length > 0 && out->offset + out->length == out->base + offset
+			&& ((block == JODY_DELTA_LITERAL && out->block == JODY_DELTA_LITERAL)
+			|| (block != JODY_DELTA_LITERAL && out->block != JODY_DELTA_LITERAL && out->block + blocks == block))) {
+		out->length += length;
+		return 0;
+	}
+	delta_flush(out);
+	out->offset = out->base + offset;
+	out->length = length;
+	out->block = block;
+	return 0;
+}
+
+/* -M: print the delta of a file against the signature in delta_sig */
+static int delta_file(FILE *fp)
+{
+	jody_block_sig_t *sigs;
+	jody_delta_index_t index;
+	struct delta_out out;
+	unsigned char *buf = NULL;
+	size_t bufsize, filled = 0, used, n;
+	uint64_t size;
+	int eof = 0;
+
+	if (sig_read(delta_sig, &sigs, &n, &size) != 0) {
+		fprintf(stderr, "error: cannot read signature: %s\n", delta_sig);
+		return 1;
+	}
+	if (jody_delta_index(&index, sigs, n, sig_blocksize, size) != 0) {
+		free(sigs);
+		return 1;
+	}
+	bufsize = (sig_blocksize < (1U << 20)) ? (1U << 22) : sig_blocksize * 4;
+	buf = (unsigned char *)malloc(bufsize);
+	if (buf == NULL) goto error;
+	memset(&out, 0, sizeof(out));
+	out.blocksize = sig_blocksize;
+	while (!eof) {
+		filled += fread(buf + filled, 1, bufsize - filled, fp);
+		if (ferror(fp)) goto error;
+		if (feof(fp)) eof = 1;
+		if (jody_delta(&index, buf, filled, eof, delta_emit, &out, &used) != 0) goto error;
+		memmove(buf, buf + used, filled - used);
+		filled -= used;
+		out.base += used;
+	}
+	delta_flush(&out);
+	fprintf(stderr, "copied %" PRIu64 " of %" PRIu64 " bytes\n", out.copied, out.base);
+	jody_delta_index_free(&index);
+	free(sigs); free(buf);
+	return 0;
+
+error:
+	jody_delta_index_free(&index);
+	free(sigs); free(buf);
+	return 1;
+}
 
 static void usage(int detailed)
 {
 	fprintf(stderr, "Jody Bruchon's hashing utility %s (%s) [%d bit width]%s\n",
 		VER, VERDATE, JODY_HASH_WIDTH,
-#if !defined NO_AVX2 && !defined NO_SSE2
-		" AVX2/SSE2 accelerated"
-#elif !defined NO_AVX2
-		" AVX2 accelerated"
-#elif !defined NO_SSE2
-		" SSE2 accelerated"
-#else
+#ifdef NO_SIMD
 		" standard"
+#else
+		" accelerated:"
+ #ifndef NO_AVX512
+		" AVX-512"
+ #endif
+ #ifndef NO_AVX2
+		" AVX2"
+ #endif
+ #ifndef NO_SSE2
+		" SSE2"
+ #endif
+ #ifndef NO_BMI2
+		" BMI2"
+ #endif
+ #ifndef NO_VECEXT
+		" vector"
+ #endif
 #endif
 		);
+#ifndef NO_SIMD
+	{
+		size_t threshold;
+		const char *kernel = jody_hash_kernel(&threshold);
+
+		if (strcmp(kernel, "none") == 0) fprintf(stderr, "Runtime kernel: none (the scalar code is fastest here)\n");
+		else if (threshold == SIZE_MAX) fprintf(stderr, "Runtime kernel: none (%s is never faster here)\n", kernel);
+		else fprintf(stderr, "Runtime kernel: %s (for blocks of %zu bytes or more)\n", kernel, threshold);
+	}
+#endif
 	if (detailed == 0) return;
-	fprintf(stderr, "usage: %s [-b|s|n|l|L] [file_to_hash]\n", progname);
+#if JODY_HASH_WIDTH == 64
+	fprintf(stderr, "usage: %s [-W|-w 128|64|32|16] [-b|s|n|l|L|B|r] [file_to_hash]\n", progname);
+#else
+	fprintf(stderr, "usage: %s [-W|-w 64|32|16] [-b|s|n|l|L|B|r] [file_to_hash]\n", progname);
+#endif
+	fprintf(stderr, "       %s -T leafsize [-D tree_file] [-b|s|n] [file_to_hash]\n", progname);
+	fprintf(stderr, "       %s -U tree_file [-b|s|n] file_to_hash [offset+length ...]\n", progname);
+	fprintf(stderr, "       %s -R blocksize [-b|s|n] [file_to_hash]\n", progname);
+	fprintf(stderr, "       %s -C [min:]avg[:max] [file_to_hash]\n", progname);
+	fprintf(stderr, "       %s -S blocksize [file_to_hash] > signature_file\n", progname);
+	fprintf(stderr, "       %s -M signature_file [file_to_hash]\n", progname);
 	fprintf(stderr, "Specifying no name or '-' as the name reads from stdin\n");
 	fprintf(stderr, "  -b|-s  Output in md5sum binary style instead of bare hashes\n");
 	fprintf(stderr, "  -n     Output just the file name after the hash\n");
 	fprintf(stderr, "  -l     Generate a hash for each text input line\n");
 	fprintf(stderr, "  -L     Same as -l but also prints hashed text after the hash\n");
 	fprintf(stderr, "  -B     Output a hash for every 4096 byte block of the file\n");
-	fprintf(stderr, "  -r     Output a rolling 4K hash\n");
+	fprintf(stderr, "  -r     Output a rolling 4K hash (the XOR of the hashes of all 4K\n");
+	fprintf(stderr, "         blocks; all CPUs are used)\n");
+	fprintf(stderr, "  -W     Use the jodyhash-wide variant (version %d) instead;\n", JODY_HASH_WIDE_VERSION);
+	fprintf(stderr, "         must come first and can be followed by another option\n");
+#if JODY_HASH_WIDTH == 64
+	fprintf(stderr, "  -w 128 Output 128-bit jodyhash128 (version %d) hashes; same rules\n", JODY_HASH128_VERSION);
+	fprintf(stderr, "         as -W except that -r can't be used\n");
+#endif
+	fprintf(stderr, "  -w N   Output jodyhash with a width of N = 64, 32 or 16 bits;\n");
+	fprintf(stderr, "         also comes first, and -r is only for %d bits\n", JODY_HASH_WIDTH);
+	fprintf(stderr, "  -T N   Output the root of a tree hash over leaves of N bytes (a\n");
+	fprintf(stderr, "         multiple of %d; K, M and G suffixes work), using all CPUs\n", (int)sizeof(jodyhash_t));
+	fprintf(stderr, "  -D F   After -T: also write the tree to the file F\n");
+	fprintf(stderr, "  -U F   Rehash only the leaves of a file that changed, as given by the\n");
+	fprintf(stderr, "         byte ranges after its name, update the tree F written by -D\n");
+	fprintf(stderr, "         and output the new root; a change of size is picked up too\n");
+	fprintf(stderr, "  -R N   Output a rolling hash over N byte blocks (K, M and G work)\n");
+	fprintf(stderr, "  -C S   Cut files into content-defined chunks of about S bytes (from\n");
+	fprintf(stderr, "         avg/4 to avg*8 unless given; K, M and G work) and output\n");
+	fprintf(stderr, "         the offset, length and hash of each chunk, one per line\n");
+	fprintf(stderr, "  -S N   Output the rsync-style signature of a file with N byte blocks\n");
+	fprintf(stderr, "  -M F   Output the delta of a file against the signature F of an old\n");
+	fprintf(stderr, "         version: 'copy offset length old_offset' for data that is in\n");
+	fprintf(stderr, "         the old file and 'literal offset length' for the rest\n");
 	return;
 }
 
@@ -125,11 +707,11 @@ int wmain(int argc, wchar_t **wargv)
 int main(int argc, char **argv)
 #endif /* UNICODE */
 {
-	static jodyhash_t blk[(BSIZE / sizeof(jodyhash_t))];
+	/* Aligned for whichever width -w picks */
+	static _Alignas(uint64_t) jodyhash_t blk[(BSIZE / sizeof(jodyhash_t))];
 	static char name[PATH_MAX + 1];
 	static size_t i;
 	static FILE *fp;
-	static jodyhash_t hash;
 	static int argnum = 1;
 	static int outmode = 0;
 	static int read_err = 0;
@@ -179,20 +761,127 @@ int main(int argc, char **argv)
 			exit(EXIT_SUCCESS);
 		}
 	}
-	if (argc > 2) {
-		if (!strcmp("-s", argv[1]) || !strcmp("-b", argv[1])) outmode = 1;
-		if (!strcmp("-l", argv[1])) outmode = 2;
-		if (!strcmp("-L", argv[1])) outmode = 3;
-		if (!strcmp("-n", argv[1])) outmode = 4;
-		if (!strcmp("-B", argv[1])) outmode = 5;
-		if (!strcmp("-r", argv[1])) outmode = 6;
-		if (outmode > 0 || !strcmp("--", argv[1])) argnum++;
+	if (argc > 1 && !strcmp("-W", argv[1])) {
+		hashfunc = jody_block_hash_wide;
+		argnum++;
+	} else if (argc > 1 && !strcmp("-w", argv[1])) {
+		if (argc > 2 && !strcmp("128", argv[2])) {
+#if JODY_HASH_WIDTH == 64
+			use128 = 1;
+#else
+			fprintf(stderr, "error: -w 128 needs a 64-bit width build\n");
+			exit(EXIT_FAILURE);
+#endif
+		} else if (argc > 2 && !strcmp("64", argv[2])) width = 64;
+		else if (argc > 2 && !strcmp("32", argv[2])) width = 32;
+		else if (argc > 2 && !strcmp("16", argv[2])) width = 16;
+		else {
+			fprintf(stderr, "error: -w only supports 128, 64, 32 and 16\n");
+			exit(EXIT_FAILURE);
+		}
+		argnum += 2;
+	} else if (argc > 1 && !strcmp("-T", argv[1])) {
+		if (argc > 2) tree_leafsize = (size_t)parse_size(argv[2], NULL);
+		if (tree_leafsize == 0 || (tree_leafsize & (sizeof(jodyhash_t) - 1)) != 0) {
+			fprintf(stderr, "error: -T needs a leaf size that is a multiple of %d bytes\n", (int)sizeof(jodyhash_t));
+			exit(EXIT_FAILURE);
+		}
+		argnum += 2;
+		if (argc > argnum + 1 && !strcmp("-D", argv[argnum])) {
+			tree_dump = argv[argnum + 1];
+			argnum += 2;
+		}
+	} else if (argc > 1 && !strcmp("-U", argv[1])) {
+		if (argc < 4) {
+			fprintf(stderr, "error: -U needs a tree file and the file it is for\n");
+			exit(EXIT_FAILURE);
+		}
+		tree_update = argv[2];
+		argnum += 2;
+	} else if (argc > 1 && !strcmp("-R", argv[1])) {
+		if (argc > 2) roll_blocksize = (size_t)parse_size(argv[2], NULL);
+		if (roll_blocksize == 0) {
+			fprintf(stderr, "error: -R needs a block size\n");
+			exit(EXIT_FAILURE);
+		}
+		argnum += 2;
+	} else if (argc > 1 && !strcmp("-C", argv[1])) {
+		uint64_t sizes[3] = { 0, 0, 0 };
+		char *p = NULL;
+		int nsizes = 0;
+
+		if (argc > 2) for (p = argv[2]; nsizes < 3; p++) {
+			sizes[nsizes++] = parse_size(p, &p);
+			if (*p != ':' || nsizes == 3) break;
+		}
+		if (p == NULL || *p != '\0' || nsizes == 2
+				|| jody_cdc_init(&cdc, (size_t)(nsizes == 3 ? sizes[0] : 0),
+					(size_t)(nsizes == 3 ? sizes[1] : sizes[0]), (size_t)(nsizes == 3 ? sizes[2] : 0)) != 0) {
+			fprintf(stderr, "error: -C needs an average chunk size or min:avg:max with min at least %d\n", JODY_CDC_MIN_SIZE);
+			exit(EXIT_FAILURE);
+		}
+		use_cdc = 1;
+		argnum += 2;
+	} else if (argc > 1 && !strcmp("-S", argv[1])) {
+		if (argc > 2) sig_blocksize = (size_t)parse_size(argv[2], NULL);
+		if (sig_blocksize == 0) {
+			fprintf(stderr, "error: -S needs a block size\n");
+			exit(EXIT_FAILURE);
+		}
+		argnum += 2;
+	} else if (argc > 1 && !strcmp("-M", argv[1])) {
+		if (argc < 3) {
+			fprintf(stderr, "error: -M needs a signature file\n");
+			exit(EXIT_FAILURE);
+		}
+		delta_sig = argv[2];
+		argnum += 2;
+	}
+	if (argc > argnum + 1) {
+		if (!strcmp("-s", argv[argnum]) || !strcmp("-b", argv[argnum])) outmode = 1;
+		if (!strcmp("-l", argv[argnum])) outmode = 2;
+		if (!strcmp("-L", argv[argnum])) outmode = 3;
+		if (!strcmp("-n", argv[argnum])) outmode = 4;
+		if (!strcmp("-B", argv[argnum])) outmode = 5;
+		if (!strcmp("-r", argv[argnum])) outmode = 6;
+		if (outmode > 0 || !strcmp("--", argv[argnum])) argnum++;
+	}
+#if JODY_HASH_WIDTH == 64
+	if (use128 && outmode == 6) {
+		fprintf(stderr, "error: -r can't be used with -w 128\n");
+		exit(EXIT_FAILURE);
+	}
+#endif
+	if (width != JODY_HASH_WIDTH && outmode == 6) {
+		fprintf(stderr, "error: -r can't be used with -w %d\n", width);
+		exit(EXIT_FAILURE);
+	}
+	if ((tree_leafsize > 0 || tree_update != NULL) && outmode != 0 && outmode != 1 && outmode != 4) {
+		fprintf(stderr, "error: only -b, -s and -n can be used with -T and -U\n");
+		exit(EXIT_FAILURE);
+	}
+	if (roll_blocksize > 0 && outmode != 0 && outmode != 1 && outmode != 4) {
+		fprintf(stderr, "error: only -b, -s and -n can be used with -R\n");
+		exit(EXIT_FAILURE);
+	}
+	if (outmode == 6) roll_blocksize = JODY_ROLLING_BLOCKSIZE;
+	if ((use_cdc || sig_blocksize > 0 || delta_sig != NULL) && outmode != 0) {
+		fprintf(stderr, "error: -C, -S and -M can't be used with other output options\n");
+		exit(EXIT_FAILURE);
+	}
+	if ((sig_blocksize > 0 || delta_sig != NULL) && argnum + 1 < argc) {
+		fprintf(stderr, "error: -S and -M work on one file only\n");
+		exit(EXIT_FAILURE);
+	}
+	if (tree_dump != NULL && argnum + 1 < argc) {
+		fprintf(stderr, "error: -D writes the tree of one file only\n");
+		exit(EXIT_FAILURE);
 	}
 
 	do {
-		hash = 0;
+		hash_reset();
 		/* Read from stdin */
-		if (argc == 1 || !strcmp("-", argv[argnum])) {
+		if (argnum >= argc || !strcmp("-", argv[argnum])) {
 			strncpy(name, "-", PATH_MAX);
 #ifdef ON_WINDOWS
 			_setmode(_fileno(stdin), _O_BINARY);
@@ -216,27 +905,66 @@ int main(int argc, char **argv)
 			continue;
 		}
 
+		/* Tree hashing with -T/-U */
+		if (tree_leafsize > 0 || tree_update != NULL) {
+			if (tree_hash(fp, argv + argnum + 1, argc - (argnum + 1)) != 0) {
+				fprintf(stderr, "error tree hashing file: ");
+				ERR(wname, name);
+				error = EXIT_FAILURE;
+				goto close_file;
+			}
+			goto print_hash;
+		}
+
+		/* Rolling hash with -r/-R */
+		if (roll_blocksize > 0) {
+			if (roll_file(fp) != 0) {
+				fprintf(stderr, "error hashing file: ");
+				ERR(wname, name);
+				error = EXIT_FAILURE;
+				goto close_file;
+			}
+			goto print_hash;
+		}
+
+		/* Content-defined chunks with -C */
+		if (use_cdc) {
+			if (cdc_file(fp) != 0) {
+				fprintf(stderr, "error chunking file: ");
+				ERR(wname, name);
+				error = EXIT_FAILURE;
+			}
+			goto close_file;
+		}
+
+		/* Signatures and deltas with -S/-M */
+		if (sig_blocksize > 0 || delta_sig != NULL) {
+			if ((delta_sig != NULL ? delta_file(fp) : sig_file(fp)) != 0) {
+				fprintf(stderr, "error making the %s of file: ", delta_sig != NULL ? "delta" : "signature");
+				ERR(wname, name);
+				error = EXIT_FAILURE;
+			}
+			goto close_file;
+		}
+
 		/* Line-by-line hashing with -l/-L */
 		if (outmode == 2 || outmode == 3) {
 			while (fgets((char *)blk, BSIZE, fp) != NULL) {
-				hash = 0;
+				hash_reset();
 				if (ferror(fp)) {
 					fprintf(stderr, "error reading file: ");
 					goto error_loop1;
 				}
-				/* Skip empty lines */
-				i = strlen((char *)blk);
-				if (i < 2 || *(char *)blk == '\n') continue;
-				/* Strip \r\n and \n and \r newlines */
-				if (((char *)blk)[i - 2] == '\r') ((char *)blk)[i - 2] = '\0';
-				else ((char *)blk)[i - 1] = '\0';
-
-				if (jody_block_hash(blk, &hash, i - 1) != 0) {
+				/* The line ending (\n or \r\n) is not hashed */
+				if (hash_line((char *)blk, &i) != 0) {
 					fprintf(stderr, "error hashing file: ");
 					goto error_loop1;
 				}
+				/* Skip empty lines */
+				if (i == 0) continue;
+				((char *)blk)[i] = '\0';
 
-				PRINTHASH(hash);
+				hash_print();
 				if (outmode == 3) printf(" '%s'\n", (char *)blk);
 				else printf("\n");
 
@@ -265,10 +993,10 @@ error_loop1:
 				size_t kbdrop;
 
 				while (i > 0) {
-					hash = 0;
+					hash_reset();
 					kbdrop = (i > kbsize) ? kbsize : i;
-					if (jody_block_hash(blk + (kblk * kboffsize), &hash, kbdrop) != 0) goto error_loop2;
-					PRINTHASH(hash); printf("\n");
+					if (hash_block(blk + (kblk * kboffsize), kbdrop) != 0) goto error_loop2;
+					hash_print(); printf("\n");
 					kblk++;
 					i -= kbdrop;
 					continue;
@@ -282,8 +1010,7 @@ error_loop2:
 #ifdef USE_PERF_CODE
 				/* perf benchmarked code */
 				ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
-				if ((outmode == 6 ? jody_rolling_block_hash(blk, &hash, i)
-						: jody_block_hash(blk, &hash, i)) != 0) {
+				if (hash_block(blk, i) != 0) {
 					fprintf(stderr, "error hashing file: ");
 					ERR(wname, name);
 					error = EXIT_FAILURE; read_err = 1;
@@ -292,9 +1019,7 @@ error_loop2:
 				ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
 #else
 				/* non-benchmarked code */
-				fprintf(stderr, "doing a rolling hash of %lu bytes\n", i);
-				if ((outmode == 6 ? jody_rolling_block_hash(blk, &hash, i)
-						: jody_block_hash(blk, &hash, i)) != 0) {
+				if (hash_block(blk, i) != 0) {
 					fprintf(stderr, "error hashing file: ");
 					ERR(wname, name);
 					error = EXIT_FAILURE; read_err = 1;
@@ -317,7 +1042,8 @@ error_loop2:
 			goto close_file;
 		}
 
-		if (outmode != 5) PRINTHASH(hash);
+print_hash:
+		if (outmode != 5) hash_print();
 
 #ifdef UNICODE
 		_setmode(_fileno(stdout), _O_U16TEXT);
@@ -334,7 +1060,8 @@ error_loop2:
 close_file:
 		fclose(fp);
 		argnum++;
-	} while (argnum < argc);
+	/* -U has a single file followed by byte ranges */
+	} while (argnum < argc && tree_update == NULL);
 
 	exit(error);
 
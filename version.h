@@ -3,7 +3,7 @@
 #ifndef JODYHASH_VERSION_H
 #define JODYHASH_VERSION_H
 
-#define VER "7.3"
-#define VERDATE "2023-06-13"
+#define VER "7.4"
+#define VERDATE "2026-10-16"
 
 #endif	/* JODYHASH_VERSION_H */